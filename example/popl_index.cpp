@@ -0,0 +1,43 @@
+/***
+    This file is part of popl (program options parser lib)
+    Copyright (C) 2015-2021 Johannes Pohl
+    
+    This software may be modified and distributed under the terms
+    of the MIT license.  See the LICENSE file for details.
+***/
+
+#include "popl.hpp"
+#include <iostream>
+
+using namespace std;
+using namespace popl;
+
+
+int main(int argc, char **argv)
+{
+	OptionParser op("Build an index file for OptionParser::parse_indexed");
+	auto help_option  = op.add<Switch>("h", "help", "produce help message");
+	auto ini_option   = op.add<Value<string>>("i", "ini", "ini file to index");
+	auto index_option = op.add<Value<string>>("o", "output", "index file to write (default: <ini>.idx)");
+
+	try
+	{
+		op.parse(argc, argv);
+		if (help_option->is_set() || !ini_option->is_set())
+		{
+			cout << op << "\n";
+			return help_option->is_set() ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+
+		string index_filename = index_option->value_or(ini_option->value() + ".idx");
+		OptionParser::build_ini_index(ini_option->value(), index_filename);
+		cout << "index written to: " << index_filename << "\n";
+	}
+	catch (const std::exception& e)
+	{
+		cerr << "Exception: " << e.what() << "\n";
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
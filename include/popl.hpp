@@ -24,18 +24,64 @@
 #define NOMINMAX
 #endif // NOMINMAX
 
+#if defined(_WIN32) && !defined(WIN32_LEAN_AND_MEAN)
+#define WIN32_LEAN_AND_MEAN
+#endif // WIN32_LEAN_AND_MEAN
+
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <iterator>
+#include <limits>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <set>
 #include <sstream>
 #include <stdexcept>
+#include <sys/stat.h>
+#include <thread>
+#include <type_traits>
+#include <typeinfo>
+#include <unordered_map>
 #include <vector>
 #ifdef WINDOWS
 #include <cctype>
 #endif
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#endif
+#ifdef __linux__
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#if defined(__cpp_impl_coroutine) && (__cpp_impl_coroutine >= 201902L)
+#include <coroutine>
+#include <exception>
+#include <utility>
+#define POPL_COROUTINES
+#endif
+
+#ifdef _WIN32
+#define POPL_ENVIRON _environ
+#else
+extern "C" char** environ;
+#define POPL_ENVIRON environ
+#endif
 
 
 namespace popl
@@ -101,6 +147,8 @@ enum class OptionName
 class Option
 {
     friend class OptionParser;
+    friend class OptionOverlay;
+    friend class OptionLayers;
 
 public:
     /// Construct an Option
@@ -147,6 +195,12 @@ public:
     /// @return true if a default value is available, false if not
     virtual bool get_default(std::ostream& out) const = 0;
 
+    /// Get the Option's value
+    /// @param out stream to write the value to
+    /// @param idx the zero based index of the value (if set multiple times)
+    /// @return true if the value at index "idx" is available, false if not (always false if not overridden)
+    virtual bool get_value(std::ostream& out, size_t idx) const;
+
     /// Set the Option's attribute
     /// @param attribute
     void set_attribute(const Attribute& attribute);
@@ -167,6 +221,12 @@ public:
     /// @return true if set at least once
     virtual bool is_set() const = 0;
 
+    /// Create a copy of the Option with its values, but without the variable it is assigned to
+    /// Used by OptionOverlay. Value, Implicit and Switch implement it for their own type only,
+    /// classes derived from them must override it to return a copy of the derived type.
+    /// @return the copy or nullptr if the Option cannot be copied
+    virtual std::shared_ptr<Option> clone() const;
+
 
 protected:
     /// Parse the command line option and fill the internal data structure
@@ -177,6 +237,12 @@ protected:
     /// Clear the internal data structure
     virtual void clear() = 0;
 
+    /// Replace values that have been parsed from ini files, used by "OptionParser::reload"
+    /// @param positions ascending indices of the values to remove
+    /// @param values a "clone" of the Option with the new values, inserted at the first removed index or appended
+    /// @return false if not supported (the default), the Option is then cleared and parsed again
+    virtual bool replace_values(const std::vector<size_t>& positions, const Option& values);
+
     std::string short_name_;
     std::string long_name_;
     std::string description_;
@@ -242,8 +308,16 @@ public:
     /// @return the Option's default value
     T get_default() const;
     bool get_default(std::ostream& out) const override;
+    bool get_value(std::ostream& out, size_t idx) const override;
 
     Argument argument_type() const override;
+    std::shared_ptr<Option> clone() const override;
+
+    /// Convert a command line argument into a value, without storing it
+    /// @param what_name the option's name the argument is given for, used for error messages
+    /// @param value the argument
+    /// @return the converted value
+    virtual T convert(OptionName what_name, const char* value) const;
 
 protected:
     void parse(OptionName what_name, const char* value) override;
@@ -252,6 +326,7 @@ protected:
     virtual void update_reference();
     virtual void add_value(const T& value);
     void clear() override;
+    bool replace_values(const std::vector<size_t>& positions, const Option& values) override;
 
     T* assign_to_;
     std::vector<T> values_;
@@ -273,9 +348,8 @@ public:
     Implicit(const std::string& short_name, const std::string& long_name, const std::string& description, const T& implicit_val, T* assign_to = nullptr);
 
     Argument argument_type() const override;
-
-protected:
-    void parse(OptionName what_name, const char* value) override;
+    std::shared_ptr<Option> clone() const override;
+    T convert(OptionName what_name, const char* value) const override;
 };
 
 
@@ -293,15 +367,28 @@ public:
 
     void set_default(const bool& value) = delete;
     Argument argument_type() const override;
-
-protected:
-    void parse(OptionName what_name, const char* value) override;
+    std::shared_ptr<Option> clone() const override;
+    bool convert(OptionName what_name, const char* value) const override;
 };
 
 
 
 using Option_ptr = std::shared_ptr<Option>;
 
+namespace detail
+{
+struct IniDocument;
+class ArgBuffer;
+} // namespace detail
+
+class ParseEvents;
+#ifdef POPL_COROUTINES
+template <typename T>
+class Generator;
+class ParseEvent;
+#endif
+
+
 /// OptionParser manages all Options
 /**
  * OptionParser manages all Options
@@ -311,6 +398,11 @@ using Option_ptr = std::shared_ptr<Option>;
  */
 class OptionParser
 {
+    friend class OptionOverlay;
+    friend class OptionLayers;
+    friend class IncrementalParser;
+    friend class ParseEvents;
+
 public:
     /// Construct the OptionParser
     /// @param description used for the help message
@@ -333,17 +425,200 @@ public:
     std::shared_ptr<T> add(Ts&&... params);
 
     /// Parse an ini file into the added Options
+    /// With "set_includes(true)" ini files can include other files (see "set_includes").
+    /// With "set_interpolation(true)" values can reference other keys (see "set_interpolation").
     /// @param ini_filename full path of the ini file
     void parse(const std::string& ini_filename);
 
+    /// Parse ini formatted data from a stream into the added Options (see "parse(ini_filename)")
+    /// The stream is read and applied line by line, the memory use is bounded by the longest line. With a profile Option
+    /// (see "set_profile_option") or interpolation (see "set_interpolation") the whole stream is tokenized before it is
+    /// applied, because overlays and references can refer to later lines. Relative includes are resolved against the
+    /// working directory.
+    /// @param in the stream
+    void parse(std::istream& in);
+
+    /// Parse ini formatted data from memory into the added Options (see "parse(ini_filename)")
+    /// The data is not copied. Relative includes are resolved against the working directory.
+    /// @param data the ini formatted data
+    /// @param size the size of data in bytes
+    void parse(const char* data, size_t size);
+
+    /// Parse a json file into the added Options
+    /// Nested objects are mapped to dotted long names, e.g. {"section":{"integer":23}} to "section.integer".
+    /// Arrays of scalars set an Option multiple times, null values are ignored, false does not set a Switch.
+    /// @param json_filename full path of the json file
+    void parse_json(const std::string& json_filename);
+
+    /// Parse json formatted data from memory into the added Options (see "parse_json(json_filename)")
+    /// @param data the json formatted data
+    /// @param size the size of data in bytes
+    void parse_json(const char* data, size_t size);
+
+    /// Parse a toml file into the added Options
+    /// Tables and dotted keys are mapped to dotted long names, e.g. "[section] integer = 23" to "section.integer".
+    /// Arrays set an Option multiple times, false does not set a Switch.
+    /// @param toml_filename full path of the toml file
+    void parse_toml(const std::string& toml_filename);
+
+    /// Parse toml formatted data from memory into the added Options (see "parse_toml(toml_filename)")
+    /// @param data the toml formatted data
+    /// @param size the size of data in bytes
+    void parse_toml(const char* data, size_t size);
+
+    /// Parse environment variables starting with "prefix" into the added Options
+    /// The environment is scanned once. The remainder of the variable name is matched case insensitive
+    /// against the long names with '.' and '-' replaced by '_', e.g. "APP_SECTION_KEY" sets "section.key"
+    /// for prefix "APP_". Options that are already set are not touched, so after "parse(argc, argv)" the
+    /// command line wins. Other sources, e.g. ini files parsed afterwards, append their values to Options
+    /// that are set by the environment. Use OptionLayers for a precedence between all sources.
+    /// "0" and "false" do not set a Switch.
+    /// @param prefix the prefix of the environment variables
+    void parse_env(const std::string& prefix);
+
+    /// Parse an ini file into the added Options, using a binary cache file
+    /// The cache holds the key value pairs of the added Options and is valid as long as
+    /// size, modification time and inode of the ini file and the added Options do not change.
+    /// Otherwise the ini file is parsed and the cache file is (re-)written.
+    /// @param ini_filename full path of the ini file
+    /// @param cache_filename full path of the cache file
+    void parse(const std::string& ini_filename, const std::string& cache_filename);
+
+    /// Parse all ini files of a directory (e.g. "conf.d") into the added Options
+    /// The files are read and tokenized in parallel and parsed in lexical order of their names,
+    /// with the same result as calling "parse(ini_filename)" for each of them.
+    /// @param directory the directory
+    /// @param extension parse only files with this extension, all files if empty
+    void parse_dir(const std::string& directory, const std::string& extension = ".conf");
+
+    /// Parse a directory with one file per key into the added Options (e.g. mounted secrets or config maps)
+    /// The file names are the long names, e.g. "section.integer", the file contents are the values without
+    /// trailing newlines. Hidden files are ignored. The files are read in parallel, large files are mapped
+    /// into memory. The directory is reparsed by "reload" and watched by the IniFileWatcher.
+    /// @param directory the directory
+    void parse_key_dir(const std::string& directory);
+
+    /// Parse only the keys of the added Options from an ini file, using an index file (see "build_ini_index")
+    /// The ini file is not scanned, but the lines of the added Options are read via their offsets.
+    /// Unknown options are not reported. Falls back to "parse(ini_filename)" if the index is missing or outdated,
+    /// if the ini file contains include directives (see "set_includes") or if a profile Option is set (see "set_profile_option").
+    /// @param ini_filename full path of the ini file
+    /// @param index_filename full path of the index file
+    void parse_indexed(const std::string& ini_filename, const std::string& index_filename);
+
+    /// Build an index file for "parse_indexed"
+    /// @param ini_filename full path of the ini file
+    /// @param index_filename full path of the index file to write
+    static void build_ini_index(const std::string& ini_filename, const std::string& index_filename);
+
     /// Parse the command line into the added Options
     /// @param argc command line argument count
     /// @param argv command line arguments
     void parse(int argc, const char* const argv[]);
 
+    /// Iterate lazily over the parse events of a command line, without storing values in the Options
+    /// The Options, "non_option_args" and "unknown_options" are not modified and required Options are not checked.
+    /// Response files are not expanded.
+    /// @param argc command line argument count
+    /// @param argv command line arguments, must outlive the returned range
+    /// @return input range of ParseEvent
+    ParseEvents events(int argc, const char* const argv[]) const;
+
+#ifdef POPL_COROUTINES
+    /// Coroutine generator of the parse events of a command line (see "events")
+    /// @param argc command line argument count
+    /// @param argv command line arguments, must outlive the generator
+    /// @return generator of ParseEvent
+    Generator<ParseEvent> generate_events(int argc, const char* const argv[]) const;
+#endif
+
+    /// Parse a command line given as one string into the added Options, e.g. from an environment variable
+    /// The string is split like by a POSIX shell (see "set_response_files"), without expansions.
+    /// It contains only the arguments, not the program name.
+    /// @param command_line the arguments
+    void parse_command_line(const std::string& command_line);
+
+    /// Parse a command line given as one string into the added Options (see "parse_command_line(command_line)")
+    /// @param data the arguments
+    /// @param size the size of data in bytes
+    void parse_command_line(const char* data, size_t size);
+
+#ifdef __linux__
+    /// Parse the command line of the current process from "/proc/self/cmdline" into the added Options
+    /// For libraries that have no access to argc and argv. The file is read once per process.
+    void parse_proc_cmdline();
+#endif
+
+    /// Expand response files "@file" on the command line
+    /// The arguments of a response file are separated by whitespace and can be quoted like in a POSIX shell,
+    /// they are parsed as if they were given in place of "@file". Response files can be nested.
+    /// Arguments after "--" and arguments of options (e.g. "--mention @bob") are not expanded.
+    /// @param enable true to expand response files
+    void set_response_files(bool enable);
+
+    /// Reparse all ini files that have been passed to "parse(ini_filename)"
+    /// Only the values of Options whose ini lines have been added, removed or modified are replaced, values of
+    /// other sources (e.g. the command line) are kept. The new values are inserted at the index of the first old one.
+    /// All new values are converted before any Option is modified, so an invalid value throws and leaves the Options
+    /// untouched. Options of own classes that do not implement "Option::clone" are cleared and parsed again instead.
+    void reload();
+
+    /// Resolve include directives in ini files
+    /// Keys outside of any section named "include" (a file) or "include_dir" (all "*.conf" files of a directory)
+    /// are then include directives, unless an Option with this long name is added. Relative paths are resolved
+    /// against the directory of the including file. Every file is included only once per parse. Disabled by default,
+    /// the keys are then reported as unknown options.
+    /// @param enable true to resolve include directives
+    void set_includes(bool enable);
+
+    /// Report the keys of ini sections without any added Option in "unknown_options"
+    /// Such sections are skipped as a whole by default, e.g. sections of other services in a shared ini file.
+    /// Unknown keys of sections with added Options are always reported.
+    /// @param enable true to report the keys of all sections
+    void set_report_unknown_sections(bool enable);
+
+    /// Expand references in the ini values of the added Options
+    /// Values can then reference other keys with "${section.key}", environment variables with "${env:NAME}"
+    /// and the number of hardware threads with "${nproc}". "$${" is a literal "${". Disabled by default.
+    /// @param enable true to expand references
+    void set_interpolation(bool enable);
+
+    /// Select ini profiles with an Option
+    /// Sections "[profile.NAME.section]" of ini files then override the keys of "[section]" if NAME is the Option's value.
+    /// A value of the Option from other sources than ini files, e.g. from the command line, selects the profile.
+    /// Otherwise the last "profile" key of the parsed ini files does, or the Option's default.
+    /// @param long_name long name of an added Value<std::string> Option
+    void set_profile_option(const std::string& long_name);
+
+    /// Create a flat snapshot of the parsed ini files
+    /// The snapshot contains length-prefixed copies of the file names, unknown options, long names and values, but no pointers,
+    /// so it can be stored or shared with other processes,
+    /// e.g. pre-forked workers, that add the same Options and call "parse_snapshot".
+    /// @return the snapshot
+    std::string snapshot() const;
+
+    /// Parse a snapshot (see "snapshot") into the added Options
+    /// @param data the snapshot
+    /// @param size the snapshot's size in bytes
+    void parse_snapshot(const char* data, size_t size);
+
+#ifdef MFD_ALLOW_SEALING
+    /// Create a snapshot (see "snapshot") in a sealed, read-only memfd
+    /// @return the memfd. Must be closed by the caller
+    int snapshot_fd() const;
+
+    /// Map a snapshot from a file descriptor (see "snapshot_fd") and parse it into the added Options
+    /// @param fd the file descriptor
+    void parse_snapshot(int fd);
+#endif
+
     /// Delete all parsed options
     void reset();
 
+    /// Free the process wide cache of tokenized ini files
+    /// Ini files are read and tokenized once and shared by all OptionParsers, as long as they are not modified
+    static void clear_ini_cache();
+
     /// Produce a help message
     /// @param max_attribute show options up to this level (optional, advanced, expert)
     /// @return the help message
@@ -368,6 +643,19 @@ public:
     /// @return vector to "stand-alone" command line arguments
     const std::vector<std::string>& unknown_options() const;
 
+    /// Get all ini files that where parsed with "parse(ini_filename)", and the directories parsed with "parse_key_dir"
+    /// @return vector of ini file names in the order of parsing
+    const std::vector<std::string>& ini_files() const;
+
+    /// Get the files and directories that are included by the parsed ini files ("include" and "include_dir")
+    /// @return set of file and directory names
+    const std::set<std::string>& included_files() const;
+
+    /// Check if a name of "ini_files()" is a directory parsed with "parse_key_dir"
+    /// @param ini_filename name of the ini file or directory
+    /// @return true if it is a directory with one file per key
+    bool is_key_dir(const std::string& ini_filename) const;
+
     /// Get an Option by it's long name
     /// @param the Option's long name
     /// @return a pointer of type "Value, Switch, Implicit" to the Option or nullptr
@@ -382,940 +670,4947 @@ public:
 
 protected:
     std::vector<Option_ptr> options_;
+    std::unordered_map<std::string, Option_ptr> long_names_;
     std::string description_;
     std::vector<std::string> non_option_args_;
     std::vector<std::string> unknown_options_;
+    /// Fingerprint of an ini line that has been applied to an Option
+    struct IniLine
+    {
+        Option_ptr option;
+        uint64_t hash;
+        std::string value;
+    };
+
+    std::shared_ptr<Value<std::string>> profile_option_;
+    std::vector<std::string> ini_files_;
+    std::set<std::string> key_dirs_;
+    /// Files and directories included by the ini files
+    std::set<std::string> included_files_;
+    bool response_files_ = false;
+    bool interpolation_ = false;
+    bool includes_ = false;
+    bool report_unknown_sections_ = false;
+    /// Applied lines per ini file, used by "reload" to reparse only changed Options
+    std::vector<std::vector<IniLine>> ini_lines_;
+    /// Indices of the values that have been parsed from "ini_lines_", per Option. Values of other sources are kept on "reload"
+    std::map<const Option*, std::vector<size_t>> ini_positions_;
+    /// Source of the latest value per Option: "command line", the ini file or key directory, the environment variable or "ini data"
+    std::map<const Option*, std::string> sources_;
+
+    /// Active Options by hash of their long name
+    using LongNameIndex = std::unordered_multimap<uint64_t, Option_ptr>;
 
     Option_ptr find_option(const std::string& long_name) const;
     Option_ptr find_option(char short_name) const;
-};
-
-
-
-class invalid_option : public std::invalid_argument
-{
-public:
-    enum class Error
+    LongNameIndex long_name_index() const;
+    Option_ptr find_option(const LongNameIndex& index, const std::string& section, const std::string& key) const;
+    /// State of parsing an ini file with its includes
+    struct IniLoad
     {
-        missing_argument,
-        invalid_argument,
-        too_many_arguments,
-        missing_option
+        LongNameIndex index;
+        std::set<std::string> prefixes;
+        std::vector<std::string> stack;
+        std::set<std::string> loaded;
+        std::vector<std::shared_ptr<const detail::IniDocument>> documents;
+        /// lines of "[profile.NAME.section]" sections with their profile NAME
+        std::vector<std::pair<std::string, IniLine>> overlays;
+        /// loaded files and included directories, in order of loading
+        std::vector<std::string> files;
+        std::vector<IniLine>& lines;
+        std::vector<std::string>& unknown_options;
     };
 
-    invalid_option(const Option* option, invalid_option::Error error, OptionName what_name, std::string value, const std::string& text)
-        : std::invalid_argument(text.c_str()), option_(option), error_(error), what_name_(what_name), value_(std::move(value))
+    /// @param previous lines of the previously parsed ini files, "ini_lines_" if nullptr
+    /// @return false if an expanded value depends on the environment, the lines must then not be cached
+    bool parse_ini(const std::string& ini_filename, std::vector<IniLine>& lines, std::vector<std::string>& unknown_options,
+                   const std::shared_ptr<const detail::IniDocument>& document = nullptr, std::vector<std::string>* files = nullptr,
+                   const std::vector<std::vector<IniLine>>* previous = nullptr) const;
+    /// The profile for "[profile.NAME.section]" overlays: a value of the profile Option from other sources than ini files,
+    /// or the last "profile" line of the previous ini files and of "lines", or the Option's default
+    std::string select_profile(const std::vector<std::vector<IniLine>>& previous, const std::vector<IniLine>& lines) const;
+    /// Sections that are a prefix of an active long name. Keys of all other sections are unknown without lookup
+    std::set<std::string> section_prefixes() const;
+    void load_ini(const std::string& ini_filename, IniLoad& load) const;
+    /// Load the file or directory of an "include" or "include_dir" directive
+    void load_include(const std::string& ini_filename, const std::string& key, const std::string& value, IniLoad& load) const;
+    void load_document(const std::string& ini_filename, const std::shared_ptr<const detail::IniDocument>& document, IniLoad& load) const;
+    void apply_ini(const std::string& ini_filename, const std::vector<IniLine>& lines, const std::vector<std::string>& unknown_options,
+                   const std::vector<std::string>& files = {});
+    void apply_lines(const std::vector<IniLine>& lines, const std::vector<std::string>& unknown_options);
+    void apply_value(const std::string& long_name, const std::string& value, bool quoted);
+    void load_key_dir(const std::string& directory, std::vector<IniLine>& lines, std::vector<std::string>& unknown_options) const;
+    void parse_args(int argc, const char* const argv[]);
+
+    /// State of splitting the command line arguments
+    struct ArgState
     {
-    }
+        /// Option with a required argument that is expected in the next argument
+        Option_ptr pending;
+        OptionName pending_name = OptionName::unspecified;
+        bool end_of_options = false;
+    };
 
-    invalid_option(const Option* option, invalid_option::Error error, const std::string& text)
-        : invalid_option(option, error, OptionName::unspecified, "", text)
+    /// Applies split arguments to the Options, "non_option_args" and "unknown_options"
+    struct ArgApplier
     {
-    }
+        OptionParser& parser;
 
-    const Option* option() const
-    {
-        return option_;
-    }
+        void option(const Option_ptr& option, OptionName what_name, const std::string& optarg)
+        {
+            option->parse(what_name, optarg.c_str());
+            parser.sources_[option.get()] = "command line";
+        }
 
-    Error error() const
-    {
-        return error_;
-    }
+        void non_option(const std::string& arg)
+        {
+            parser.non_option_args_.push_back(arg);
+        }
 
-    OptionName what_name() const
-    {
-        return what_name_;
-    }
+        void unknown(const std::string& arg)
+        {
+            parser.unknown_options_.push_back(arg);
+        }
 
-    std::string value() const
+        void end_of_options()
+        {
+        }
+    };
+
+    /// Ignores split arguments, used to track the ArgState only
+    struct ArgTracker
     {
-        return value_;
-    }
+        void option(const Option_ptr&, OptionName, const std::string&)
+        {
+        }
 
-private:
-    const Option* option_;
-    Error error_;
-    OptionName what_name_;
-    std::string value_;
+        void non_option(const std::string&)
+        {
+        }
+
+        void unknown(const std::string&)
+        {
+        }
+
+        void end_of_options()
+        {
+        }
+    };
+
+    /// Split one command line argument, calling the handler's "option(option, what_name, optarg)",
+    /// "non_option(arg)", "unknown(arg)" and "end_of_options()"
+    template <typename Handler>
+    void split_arg(const char* argument, ArgState& state, Handler& handler) const;
+    template <typename Handler>
+    void finish_args(ArgState& state, Handler& handler) const;
+    void check_required() const;
+    void expand_response_files(const char* const* begin, const char* const* end, std::vector<const char*>& args,
+                               std::vector<std::unique_ptr<detail::ArgBuffer>>& buffers, std::vector<std::string>& stack, ArgState& state) const;
+
+    /// call "callback(option, variable, value)" for each environment variable starting with "prefix"
+    /// option is nullptr for unknown variables
+    template <typename Callback>
+    void for_each_env(const std::string& prefix, Callback callback) const;
+    uint64_t schema_hash() const;
+    void write_lines(std::string& buffer, const std::vector<IniLine>& lines) const;
+    bool read_lines(const char*& pos, const char* end, std::vector<IniLine>& lines) const;
 };
 
 
 
-/// Base class for an OptionPrinter
+/// Writer for ini files
 /**
- * OptionPrinter creates a help message for a given OptionParser
+ * Writes the values of an OptionParser's Options in ini format, grouped by the sections
+ * of their long names ("section.key"). Values are streamed directly to the output.
+ * Options without long name, inactive Options, Options that are not set and do not require an argument
+ * (Switches and Implicit values) and empty values are skipped, so that the output can be read back.
  */
-class OptionPrinter
+class IniWriter
 {
 public:
     /// Constructor
-    /// @param option_parser the OptionParser to create the help message from
-    explicit OptionPrinter(const OptionParser* option_parser) : option_parser_(option_parser)
-    {
-    }
-
-    /// Destructor
-    virtual ~OptionPrinter() = default;
-
-    /// Create a help message
-    /// @param max_attribute show options up to this level (optional, advanced, expert)
-    /// @return the help message
-    virtual std::string print(const Attribute& max_attribute = Attribute::optional) const = 0;
+    /// @param option_parser the OptionParser to write the values of
+    explicit IniWriter(const OptionParser* option_parser);
+
+    /// Write the values
+    /// @param out the stream to write to
+    /// @param non_default_only write only Options that are set to a value other than their default
+    void write(std::ostream& out, bool non_default_only = false) const;
+
+#ifdef __linux__
+    /// Write the values
+    /// @param fd the file descriptor to write to
+    /// @param non_default_only write only Options that are set to a value other than their default
+    void write(int fd, bool non_default_only = false) const;
+#endif
 
 protected:
+    bool write(std::ostream& out, const Option_ptr& option, const std::string& key, bool non_default_only) const;
+
     const OptionParser* option_parser_;
 };
 
 
 
-/// Option printer for the console
+/// Overlay of an OptionParser
 /**
- * Standard console option printer
- * Creates a human readable help message
+ * Overrides single Options of a parsed OptionParser, e.g. per tenant, without copying it.
+ * Only the overridden Options are stored, all others are read from the base OptionParser.
  */
-class ConsoleOptionPrinter : public OptionPrinter
+class OptionOverlay
 {
 public:
-    explicit ConsoleOptionPrinter(const OptionParser* option_parser);
-    ~ConsoleOptionPrinter() override = default;
+    /// Constructor
+    /// @param option_parser the base OptionParser. Must outlive the overlay
+    explicit OptionOverlay(const OptionParser* option_parser);
 
-    std::string print(const Attribute& max_attribute = Attribute::optional) const override;
+    /// Override an Option's value
+    /// @param long_name the Option's long name
+    /// @param value the value as given in an ini file
+    void set(const std::string& long_name, const std::string& value);
 
-private:
-    std::string to_string(Option_ptr option) const;
+    /// Override the Options that are set in an ini file (see "OptionParser::parse(ini_filename)")
+    /// @param ini_filename full path of the ini file
+    void parse(const std::string& ini_filename);
+
+    /// Remove an override
+    /// @param long_name the Option's long name
+    void reset(const std::string& long_name);
+
+    /// Get the number of overridden Options
+    /// @return the number of overridden Options
+    size_t size() const;
+
+    /// Get an Option by it's long name, either the overridden or the base OptionParser's Option
+    /// @param the Option's long name
+    /// @return a pointer of type "Value, Switch, Implicit" to the Option
+    template <typename T>
+    std::shared_ptr<T> get_option(const std::string& long_name) const;
+
+protected:
+    Option_ptr override_option(const Option_ptr& option);
+
+    const OptionParser* option_parser_;
+    std::unordered_map<std::string, Option_ptr> overrides_;
 };
 
 
 
-/// Option printer for man pages
+/// Layered value sources of an OptionParser
 /**
- * Creates help messages in groff format that can be used in man pages
+ * Collects the raw values of several sources (ini files, environment, explicit values), each with a priority.
+ * An Option is resolved on first access from the highest priority layer that has values for it, the
+ * values of lower layers are never converted. Options that are already set, e.g. on the command line with
+ * "OptionParser::parse(argc, argv)", always win, Options without any value keep their default.
  */
-class GroffOptionPrinter : public OptionPrinter
+class OptionLayers
 {
 public:
-    explicit GroffOptionPrinter(const OptionParser* option_parser);
-    ~GroffOptionPrinter() override = default;
+    /// Constructor
+    /// @param option_parser the OptionParser whose Options are resolved. Must outlive the layers
+    explicit OptionLayers(OptionParser* option_parser);
 
-    std::string print(const Attribute& max_attribute = Attribute::optional) const override;
+    /// Add a raw value to a layer
+    /// @param priority the layer's priority, higher priorities win
+    /// @param long_name the Option's long name
+    /// @param value the value as given in an ini file
+    void set(int priority, const std::string& long_name, const std::string& value);
 
-private:
-    std::string to_string(Option_ptr option) const;
+    /// Add the values of an ini file to a layer (see "OptionParser::parse(ini_filename)")
+    /// @param priority the layer's priority, higher priorities win
+    /// @param ini_filename full path of the ini file
+    void parse(int priority, const std::string& ini_filename);
+
+    /// Add the values of environment variables to a layer (see "OptionParser::parse_env(prefix)")
+    /// @param priority the layer's priority, higher priorities win
+    /// @param prefix the prefix of the environment variables
+    void parse_env(int priority, const std::string& prefix);
+
+    /// Get an Option by it's long name, resolving it's value on first access
+    /// @param the Option's long name
+    /// @return a pointer of type "Value, Switch, Implicit" to the Option
+    template <typename T>
+    std::shared_ptr<T> get_option(const std::string& long_name);
+
+    /// Resolve all Options that are not resolved yet
+    void resolve();
+
+    /// Get the source of an Option's value, resolving it if needed
+    /// @param the Option's long name
+    /// @return "command line", the ini file, the environment variable, "set" or an empty string if the Option is not set.
+    /// Options that are set directly by the OptionParser report "ini data" for streams and memory, "other" if set by the application
+    std::string source(const std::string& long_name);
+
+protected:
+    struct Layer
+    {
+        std::string source;
+        std::vector<std::string> values;
+    };
+
+    void add(int priority, const Option_ptr& option, const std::string& source, const std::string& value);
+    const std::string& resolve(const Option_ptr& option);
+
+    OptionParser* option_parser_;
+    /// per long name the layers, highest priority first
+    std::unordered_map<std::string, std::map<int, Layer, std::greater<int>>> layers_;
+    /// per long name the source of the resolved value
+    std::unordered_map<std::string, std::string> resolved_;
 };
 
 
 
-/// Option printer for bash completion
+/// Incremental command line parser
 /**
- * Creates a script with all options (short and long) that can be used for bash completion
+ * Parses command line arguments that arrive one by one, e.g. from an interactive shell or a socket,
+ * with the same result as "OptionParser::parse(argc, argv)".
+ * Every argument is applied to the Options as soon as it is complete, an Option with a required
+ * argument is completed by the next argument. "finish()" checks for required Options.
  */
-class BashCompletionOptionPrinter : public OptionPrinter
+class IncrementalParser
 {
 public:
-    BashCompletionOptionPrinter(const OptionParser* option_parser, std::string program_name);
-    ~BashCompletionOptionPrinter() override = default;
+    /// Constructor
+    /// @param option_parser the OptionParser to parse into. Must outlive the IncrementalParser
+    explicit IncrementalParser(OptionParser& option_parser);
 
-    std::string print(const Attribute& max_attribute = Attribute::optional) const override;
+    /// Parse the next argument (without the program name)
+    /// @param arg the argument
+    void feed(const std::string& arg);
+
+    /// Check if an Option waits for it's argument
+    /// @return true if the next argument is the argument of an Option
+    bool pending() const;
+
+    /// Finish parsing: an Option that waits for it's argument is missing it, required Options must be set.
+    /// Afterwards a new command line can be fed.
+    void finish();
 
 private:
-    std::string program_name_;
+    OptionParser& option_parser_;
+    OptionParser::ArgState state_;
 };
 
 
 
-/// Option implementation /////////////////////////////////
-
-inline Option::Option(const std::string& short_name, const std::string& long_name, std::string description)
-    : short_name_(short_name), long_name_(long_name), description_(std::move(description)), attribute_(Attribute::optional)
+/// Event of parsing a command line (see "OptionParser::events")
+class ParseEvent
 {
-    if (short_name.size() > 1)
-        throw std::invalid_argument("length of short name must be <= 1: '" + short_name + "'");
+public:
+    enum class Type
+    {
+        option,        // an Option with it's argument
+        non_option,    // a non option argument
+        unknown,       // an unknown option
+        end_of_options // the "--" boundary, all following arguments are non option arguments
+    };
 
-    if (short_name.empty() && long_name.empty())
-        throw std::invalid_argument("short and long name are empty");
-}
+    ParseEvent(Type type, Option_ptr option, OptionName what_name, std::string arg);
 
+    /// Get the event's type
+    /// @return the type
+    Type type() const;
 
-inline char Option::short_name() const
-{
-    if (!short_name_.empty())
-        return short_name_[0];
-    return 0;
-}
+    /// Get the Option of an "option" event
+    /// @return the Option or nullptr
+    const Option_ptr& option() const;
 
+    /// Get the name the Option is given with
+    /// @return short_name or long_name
+    OptionName what_name() const;
 
-inline std::string Option::long_name() const
-{
-    return long_name_;
-}
+    /// Get the argument
+    /// @return the Option's argument (can be empty) or the non option or unknown argument
+    const std::string& arg() const;
 
+    /// Convert the Option's argument (see "Value<T>::convert"). Will throw if the Option is not a Value<T>.
+    /// @return the converted value
+    template <typename T>
+    T value() const;
 
-inline std::string Option::name(OptionName what_name, bool with_hypen) const
-{
-    if (what_name == OptionName::short_name)
-        return short_name_.empty() ? "" : ((with_hypen ? "-" : "") + short_name_);
-    if (what_name == OptionName::long_name)
-        return long_name_.empty() ? "" : ((with_hypen ? "--" : "") + long_name_);
-    return "";
-}
+private:
+    Type type_;
+    Option_ptr option_;
+    OptionName what_name_;
+    std::string arg_;
+};
 
 
-inline std::string Option::description() const
+/// Input range of the parse events of a command line (see "OptionParser::events")
+/**
+ * The arguments are split while iterating, an argument with bundled short options can produce
+ * multiple events. The range can be iterated only once.
+ */
+class ParseEvents
 {
-    return description_;
-}
-
+public:
+    class iterator
+    {
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = ParseEvent;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const ParseEvent*;
+        using reference = const ParseEvent&;
+
+        explicit iterator(ParseEvents* events = nullptr);
+        reference operator*() const;
+        pointer operator->() const;
+        iterator& operator++();
+        bool operator==(const iterator& other) const;
+        bool operator!=(const iterator& other) const;
+
+    private:
+        ParseEvents* events_;
+    };
 
-inline void Option::set_attribute(const Attribute& attribute)
-{
-    attribute_ = attribute;
-}
+    ParseEvents(const OptionParser* option_parser, int argc, const char* const argv[]);
 
+    iterator begin();
+    iterator end();
 
-inline Attribute Option::attribute() const
-{
-    return attribute_;
-}
+private:
+    /// Collects the events of one split argument
+    struct Collector
+    {
+        std::vector<ParseEvent>& events;
 
+        void option(const Option_ptr& option, OptionName what_name, const std::string& optarg)
+        {
+            events.emplace_back(ParseEvent::Type::option, option, what_name, optarg);
+        }
 
+        void non_option(const std::string& arg)
+        {
+            events.emplace_back(ParseEvent::Type::non_option, nullptr, OptionName::unspecified, arg);
+        }
 
-/// Value implementation /////////////////////////////////
+        void unknown(const std::string& arg)
+        {
+            events.emplace_back(ParseEvent::Type::unknown, nullptr, OptionName::unspecified, arg);
+        }
 
-template <class T>
-inline Value<T>::Value(const std::string& short_name, const std::string& long_name, const std::string& description)
-    : Option(short_name, long_name, description), assign_to_(nullptr)
-{
-}
+        void end_of_options()
+        {
+            events.emplace_back(ParseEvent::Type::end_of_options, nullptr, OptionName::unspecified, "--");
+        }
+    };
 
+    /// advance to the next event
+    /// @return false if there are no more events
+    bool next();
 
-template <class T>
-inline Value<T>::Value(const std::string& short_name, const std::string& long_name, const std::string& description, const T& default_val, T* assign_to)
-    : Value<T>(short_name, long_name, description)
-{
-    assign_to_ = assign_to;
-    set_default(default_val);
-}
+    const OptionParser* option_parser_;
+    int argc_;
+    const char* const* argv_;
+    int arg_;
+    bool finished_;
+    OptionParser::ArgState state_;
+    std::vector<ParseEvent> events_;
+    size_t event_;
+};
+
+
+#ifdef POPL_COROUTINES
+/// Minimal coroutine generator, an input range of the yielded values
+template <typename T>
+class Generator
+{
+public:
+    struct promise_type
+    {
+        const T* value = nullptr;
+        std::exception_ptr exception;
+
+        Generator get_return_object()
+        {
+            return Generator(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+
+        std::suspend_always initial_suspend() noexcept
+        {
+            return {};
+        }
+
+        std::suspend_always final_suspend() noexcept
+        {
+            return {};
+        }
+
+        std::suspend_always yield_value(const T& yielded) noexcept
+        {
+            value = std::addressof(yielded);
+            return {};
+        }
+
+        void return_void() noexcept
+        {
+        }
+
+        void unhandled_exception()
+        {
+            exception = std::current_exception();
+        }
+    };
+
+    class iterator
+    {
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const T*;
+        using reference = const T&;
+
+        explicit iterator(std::coroutine_handle<promise_type> handle = nullptr) : handle_(handle)
+        {
+        }
+
+        reference operator*() const
+        {
+            return *handle_.promise().value;
+        }
+
+        pointer operator->() const
+        {
+            return handle_.promise().value;
+        }
+
+        iterator& operator++()
+        {
+            resume(handle_);
+            if (handle_.done())
+                handle_ = nullptr;
+            return *this;
+        }
+
+        bool operator==(const iterator& other) const
+        {
+            return handle_ == other.handle_;
+        }
+
+        bool operator!=(const iterator& other) const
+        {
+            return handle_ != other.handle_;
+        }
+
+    private:
+        std::coroutine_handle<promise_type> handle_;
+    };
+
+    explicit Generator(std::coroutine_handle<promise_type> handle) : handle_(handle)
+    {
+    }
+
+    Generator(Generator&& other) noexcept : handle_(other.handle_)
+    {
+        other.handle_ = nullptr;
+    }
+
+    Generator(const Generator&) = delete;
+    Generator& operator=(const Generator&) = delete;
+    Generator& operator=(Generator&&) = delete;
+
+    ~Generator()
+    {
+        if (handle_)
+            handle_.destroy();
+    }
+
+    iterator begin()
+    {
+        resume(handle_);
+        return handle_.done() ? iterator() : iterator(handle_);
+    }
+
+    iterator end()
+    {
+        return iterator();
+    }
+
+private:
+    static void resume(std::coroutine_handle<promise_type> handle)
+    {
+        handle.resume();
+        if (handle.promise().exception)
+            std::rethrow_exception(std::exchange(handle.promise().exception, nullptr));
+    }
+
+    std::coroutine_handle<promise_type> handle_;
+};
+#endif
+
+
+
+class invalid_option : public std::invalid_argument
+{
+public:
+    enum class Error
+    {
+        missing_argument,
+        invalid_argument,
+        too_many_arguments,
+        missing_option
+    };
+
+    invalid_option(const Option* option, invalid_option::Error error, OptionName what_name, std::string value, const std::string& text)
+        : std::invalid_argument(text.c_str()), option_(option), error_(error), what_name_(what_name), value_(std::move(value))
+    {
+    }
+
+    invalid_option(const Option* option, invalid_option::Error error, const std::string& text)
+        : invalid_option(option, error, OptionName::unspecified, "", text)
+    {
+    }
+
+    const Option* option() const
+    {
+        return option_;
+    }
+
+    Error error() const
+    {
+        return error_;
+    }
+
+    OptionName what_name() const
+    {
+        return what_name_;
+    }
+
+    std::string value() const
+    {
+        return value_;
+    }
+
+private:
+    const Option* option_;
+    Error error_;
+    OptionName what_name_;
+    std::string value_;
+};
+
+
+
+/// Base class for an OptionPrinter
+/**
+ * OptionPrinter creates a help message for a given OptionParser
+ */
+class OptionPrinter
+{
+public:
+    /// Constructor
+    /// @param option_parser the OptionParser to create the help message from
+    explicit OptionPrinter(const OptionParser* option_parser) : option_parser_(option_parser)
+    {
+    }
+
+    /// Destructor
+    virtual ~OptionPrinter() = default;
+
+    /// Create a help message
+    /// @param max_attribute show options up to this level (optional, advanced, expert)
+    /// @return the help message
+    virtual std::string print(const Attribute& max_attribute = Attribute::optional) const = 0;
+
+protected:
+    const OptionParser* option_parser_;
+};
+
+
+
+/// Option printer for the console
+/**
+ * Standard console option printer
+ * Creates a human readable help message
+ */
+class ConsoleOptionPrinter : public OptionPrinter
+{
+public:
+    explicit ConsoleOptionPrinter(const OptionParser* option_parser);
+    ~ConsoleOptionPrinter() override = default;
+
+    std::string print(const Attribute& max_attribute = Attribute::optional) const override;
+
+private:
+    std::string to_string(Option_ptr option) const;
+};
+
+
+
+/// Option printer for man pages
+/**
+ * Creates help messages in groff format that can be used in man pages
+ */
+class GroffOptionPrinter : public OptionPrinter
+{
+public:
+    explicit GroffOptionPrinter(const OptionParser* option_parser);
+    ~GroffOptionPrinter() override = default;
+
+    std::string print(const Attribute& max_attribute = Attribute::optional) const override;
+
+private:
+    std::string to_string(Option_ptr option) const;
+};
+
+
+
+/// Option printer for bash completion
+/**
+ * Creates a script with all options (short and long) that can be used for bash completion
+ */
+class BashCompletionOptionPrinter : public OptionPrinter
+{
+public:
+    BashCompletionOptionPrinter(const OptionParser* option_parser, std::string program_name);
+    ~BashCompletionOptionPrinter() override = default;
+
+    std::string print(const Attribute& max_attribute = Attribute::optional) const override;
+
+private:
+    std::string program_name_;
+};
+
+
+
+#ifdef __linux__
+/// Watcher for ini files
+/**
+ * Watches the ini files, their included files and the key directories of an OptionParser
+ * (see "OptionParser::ini_files" and "OptionParser::included_files") with inotify
+ * Bursts of writes and renames (e.g. atomic replace by editors) are coalesced and
+ * the files are reparsed with "OptionParser::reload" only if their content has changed.
+ * Integrate "fd()" into a poll/epoll loop: call "process()" if it is readable or if
+ * "timeout()" ms have elapsed, or block with "wait(timeout_ms)". "process()" never blocks.
+ */
+class IniFileWatcher
+{
+public:
+    /// Constructor
+    /// @param option_parser the OptionParser to reload on changes
+    /// @param debounce_ms wait until no more changes are reported for this time before reloading
+    explicit IniFileWatcher(OptionParser& option_parser, int debounce_ms = 100);
+
+    /// Destructor
+    ~IniFileWatcher();
+
+    IniFileWatcher(const IniFileWatcher&) = delete;
+    IniFileWatcher& operator=(const IniFileWatcher&) = delete;
+
+    /// Get the inotify file descriptor
+    /// @return the file descriptor that becomes readable on changes
+    int fd() const;
+
+    /// Read pending change notifications and reload if the content of an ini file has changed
+    /// Does not block: after a change the reload is deferred until the files are quiet for debounce_ms
+    /// (but at most 10 times as long), call "process()" again once "timeout()" has elapsed
+    /// @return true if the ini files have been reloaded
+    bool process();
+
+    /// Get the time until a deferred reload is due
+    /// @return the timeout in ms to pass to poll/epoll_wait, -1 if no reload is pending
+    int timeout() const;
+
+    /// Wait for changes and reload if the content of an ini file has changed
+    /// @param timeout_ms max time to wait in ms, -1 to wait infinitely
+    /// @return true if the ini files have been reloaded
+    bool wait(int timeout_ms = -1);
+
+private:
+    std::vector<std::string> watched_files() const;
+    void add_watches();
+    bool drain();
+    bool content_changed();
+
+    OptionParser& option_parser_;
+    int debounce_ms_;
+    int fd_;
+    bool pending_;
+    std::chrono::steady_clock::time_point first_change_;
+    std::chrono::steady_clock::time_point deadline_;
+    std::set<std::string> watched_;
+    std::vector<std::pair<int, std::string>> watches_;
+    std::map<std::string, uint64_t> hashes_;
+};
+#endif
+
+
+
+/// Helper implementation /////////////////////////////////
+
+namespace detail
+{
+
+/// Write a value
+template <typename T>
+inline void write_value(std::ostream& out, const T& value, std::false_type /*floating_point*/)
+{
+    out << value;
+}
+
+
+/// Write a floating point value with the least digits that are parsed back to the same value
+template <typename T>
+inline void write_value(std::ostream& out, const T& value, std::true_type /*floating_point*/)
+{
+    std::stringstream ss;
+    ss.flags(out.flags());
+    for (int precision = std::numeric_limits<T>::digits10; precision <= std::numeric_limits<T>::max_digits10; ++precision)
+    {
+        ss.str("");
+        ss.clear();
+        ss.precision(precision);
+        ss << value;
+        T parsed;
+        if ((ss >> parsed) && (parsed == value))
+            break;
+    }
+    out << ss.str();
+}
+
+
+/// 64 bit FNV-1a hash
+inline uint64_t fnv1a(const char* data, size_t size, uint64_t hash = 14695981039346656037ULL)
+{
+    for (size_t n = 0; n < size; ++n)
+    {
+        hash ^= static_cast<unsigned char>(data[n]);
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+
+/// Remove leading and trailing whitespace
+inline std::string& trim(std::string& s)
+{
+    s.erase(s.begin(), std::find_if(s.begin(), s.end(), [](int ch) { return !std::isspace(ch); }));
+    s.erase(std::find_if(s.rbegin(), s.rend(), [](int ch) { return !std::isspace(ch); }).base(), s.end());
+    return s;
+}
+
+
+/// Split a trimmed ini line "key = value" into its trimmed key and value
+/// @return empty key and value if the line has no '='
+inline std::pair<std::string, std::string> split(const std::string& s)
+{
+    size_t pos = s.find('=');
+    if (pos == std::string::npos)
+        return {"", ""};
+    std::string key = s.substr(0, pos);
+    std::string value = s.substr(pos + 1, std::string::npos);
+    return {trim(key), trim(value)};
+}
+
+
+/// Tokenize an ini stream
+/// @param in the stream to read from
+/// @param callback called for every key value pair as "callback(section, key, value, offset)".
+///        offset is the position of the line in the stream
+template <typename Callback>
+inline void parse_ini(std::istream& in, Callback callback)
+{
+    std::string line;
+    std::string section;
+    size_t offset = 0;
+    size_t line_offset = 0;
+    while (std::getline(in, line))
+    {
+        line_offset = offset;
+        offset += line.size() + 1;
+        trim(line);
+        if (line.empty())
+            continue;
+        if (line.front() == '#')
+            continue;
+
+        if ((line.front() == '[') && (line.back() == ']'))
+        {
+            section = line.substr(1, line.size() - 2);
+            trim(section);
+            continue;
+        }
+        auto key_value = split(line);
+        if (key_value.first.empty())
+            continue;
+
+        callback(section, key_value.first, key_value.second, line_offset);
+    }
+}
+
+
+/// Identity of a file, used to detect modifications
+struct FileStamp
+{
+    uint64_t size;
+    uint64_t mtime;
+    uint64_t inode;
+
+    bool operator==(const FileStamp& other) const
+    {
+        return (size == other.size) && (mtime == other.mtime) && (inode == other.inode);
+    }
+};
+
+
+/// Get the identity of a file
+/// @return false if the file does not exist
+inline bool file_stamp(const std::string& filename, FileStamp& stamp)
+{
+    struct stat st;
+    if (stat(filename.c_str(), &st) != 0)
+        return false;
+    stamp.size = static_cast<uint64_t>(st.st_size);
+#ifdef __linux__
+    stamp.mtime = static_cast<uint64_t>(st.st_mtim.tv_sec) * 1000000000ULL + static_cast<uint64_t>(st.st_mtim.tv_nsec);
+#else
+    stamp.mtime = static_cast<uint64_t>(st.st_mtime);
+#endif
+    stamp.inode = static_cast<uint64_t>(st.st_ino);
+    return true;
+}
+
+
+/// Append a fixed size integer in native byte order
+template <typename T>
+inline void put(std::string& buffer, T value)
+{
+    buffer.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+
+/// Append a length prefixed string
+inline void put(std::string& buffer, const std::string& value)
+{
+    put(buffer, static_cast<uint32_t>(value.size()));
+    buffer.append(value);
+}
+
+
+/// Append a length prefixed list of strings
+inline void put(std::string& buffer, const std::vector<std::string>& values)
+{
+    put(buffer, static_cast<uint32_t>(values.size()));
+    for (const auto& value : values)
+        put(buffer, value);
+}
+
+
+/// Read a fixed size integer in native byte order
+/// @return false if the buffer is too short
+template <typename T>
+inline bool get(const char*& pos, const char* end, T& value)
+{
+    if (static_cast<size_t>(end - pos) < sizeof(T))
+        return false;
+    memcpy(&value, pos, sizeof(T));
+    pos += sizeof(T);
+    return true;
+}
+
+
+/// Read a length prefixed string
+/// @return false if the buffer is too short
+inline bool get(const char*& pos, const char* end, std::string& value)
+{
+    uint32_t size;
+    if (!get(pos, end, size) || (static_cast<size_t>(end - pos) < size))
+        return false;
+    value.assign(pos, size);
+    pos += size;
+    return true;
+}
+
+
+/// Read a length prefixed list of strings
+/// @return false if the buffer is too short
+inline bool get(const char*& pos, const char* end, std::vector<std::string>& values)
+{
+    uint32_t count;
+    if (!get(pos, end, count))
+        return false;
+    values.resize(count);
+    for (auto& value : values)
+        if (!get(pos, end, value))
+            return false;
+    return true;
+}
+
+
+/// List the regular files of a directory
+/// @param directory the directory
+/// @param extension list only files with this extension, all files if empty
+/// @return the file names, prefixed with the directory, in unspecified order
+inline std::vector<std::string> list_files(const std::string& directory, const std::string& extension)
+{
+    std::vector<std::string> names;
+#ifdef _WIN32
+    WIN32_FIND_DATAA data;
+    HANDLE handle = FindFirstFileA((directory + "\\*").c_str(), &data);
+    if (handle == INVALID_HANDLE_VALUE)
+        throw std::runtime_error("failed to open directory: " + directory);
+    do
+    {
+        if ((data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) == 0)
+            names.emplace_back(data.cFileName);
+    } while (FindNextFileA(handle, &data) != 0);
+    FindClose(handle);
+#else
+    DIR* dir = opendir(directory.c_str());
+    if (dir == nullptr)
+        throw std::runtime_error("failed to open directory: " + directory);
+    while (struct dirent* entry = readdir(dir))
+        names.emplace_back(entry->d_name);
+    closedir(dir);
+#endif
+
+    std::vector<std::string> files;
+    for (const auto& name : names)
+    {
+        if ((name.size() < extension.size()) || (name.compare(name.size() - extension.size(), extension.size(), extension) != 0))
+            continue;
+        std::string filename = directory + "/" + name;
+        struct stat st;
+        if ((stat(filename.c_str(), &st) == 0) && ((st.st_mode & S_IFMT) == S_IFREG))
+            files.push_back(filename);
+    }
+    return files;
+}
+
+
+/// Resolve a path relative to the directory of a file
+/// @param filename the file
+/// @param path absolute path or path relative to the directory of filename
+inline std::string resolve_path(const std::string& filename, const std::string& path)
+{
+    if (path.empty() || (path[0] == '/') || (path[0] == '\\') || ((path.size() > 1) && (path[1] == ':')))
+        return path;
+    size_t pos = filename.find_last_of("/\\");
+    if (pos == std::string::npos)
+        return path;
+
+    /// lexically remove "." and "dir/.." components, so that include cycles are detected by name
+    std::vector<std::string> components;
+    std::stringstream ss(filename.substr(0, pos + 1) + path);
+    std::string component;
+    while (std::getline(ss, component, '/'))
+    {
+        if (component == ".")
+            continue;
+        if ((component == "..") && !components.empty() && (components.back() != "..") && !components.back().empty())
+            components.pop_back();
+        else
+            components.push_back(component);
+    }
+    std::string result;
+    for (size_t n = 0; n < components.size(); ++n)
+        result += (n == 0 ? "" : "/") + components[n];
+    return result;
+}
+
+
+/// Read the complete content of a file
+/// @return false if the file cannot be opened
+inline bool read_file(const std::string& filename, std::string& content)
+{
+    std::ifstream file(filename.c_str(), std::ios::in | std::ios::binary);
+    if (!file)
+        return false;
+    std::ostringstream ss;
+    ss << file.rdbuf();
+    content = ss.str();
+    return true;
+}
+
+
+/// List the non-hidden files of a directory with one file per key, sorted by name
+inline std::vector<std::string> list_key_files(const std::string& directory)
+{
+    std::vector<std::string> files = list_files(directory, "");
+    files.erase(std::remove_if(files.begin(), files.end(), [&directory](const std::string& file) { return file[directory.size() + 1] == '.'; }),
+                files.end());
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+
+
+/// Get the absolute path of an existing file with resolved symlinks
+/// @return the canonical path, or filename if it does not exist
+inline std::string canonical_path(const std::string& filename)
+{
+#ifdef _WIN32
+    char path[_MAX_PATH];
+    if (_fullpath(path, filename.c_str(), _MAX_PATH) != nullptr)
+        return path;
+#else
+    char* path = realpath(filename.c_str(), nullptr);
+    if (path != nullptr)
+    {
+        std::string result(path);
+        free(path);
+        return result;
+    }
+#endif
+    return filename;
+}
+
+/// Run "worker" on up to "count" threads, including the calling one. The worker must pull its items from a shared counter.
+/// Without POPL_THREADS the worker runs on the calling thread only, so that popl does not require the thread library.
+template <typename Worker>
+inline void run_workers(size_t count, const Worker& worker)
+{
+#ifdef POPL_THREADS
+    size_t thread_count = std::min(static_cast<size_t>(std::max(1u, std::thread::hardware_concurrency())), count);
+    std::vector<std::thread> threads;
+    for (size_t n = 1; n < thread_count; ++n)
+        threads.emplace_back(worker);
+    worker();
+    for (auto& thread : threads)
+        thread.join();
+#else
+    (void)count;
+    worker();
+#endif
+}
+
+/// Range of entries in a tokenized ini file that belong to one section
+struct IniSection
+{
+    std::string name;
+    size_t begin;
+    size_t end;
+};
+
+
+/// Tokenized ini file
+struct IniDocument
+{
+    FileStamp stamp;
+    std::vector<IniSection> sections;
+    /// key (without section) and value
+    std::vector<std::pair<std::string, std::string>> entries;
+};
+
+
+/// Tokenize an ini stream into a document
+inline std::shared_ptr<IniDocument> tokenize_ini(std::istream& in)
+{
+    auto document = std::make_shared<IniDocument>();
+    document->stamp = {0, 0, 0};
+    parse_ini(in, [&document](const std::string& section, const std::string& key, const std::string& value, size_t /*offset*/) {
+        auto& sections = document->sections;
+        if (sections.empty() || (sections.back().name != section))
+            sections.push_back({section, document->entries.size(), document->entries.size()});
+        document->entries.emplace_back(key, value);
+        sections.back().end = document->entries.size();
+    });
+    return document;
+}
+
+
+/// Read only stream buffer on a memory region, without copying it
+class MemoryStreamBuf : public std::streambuf
+{
+public:
+    MemoryStreamBuf(const char* data, size_t size)
+    {
+        char* begin = const_cast<char*>(data);
+        setg(begin, begin, begin + size);
+    }
+};
+
+
+/// Writable buffer of a file or string, one byte larger than the data, to be split into arguments in place
+/**
+ * Files are mapped private (copy on write) if the byte following the data lies in the last mapped page,
+ * otherwise they are read.
+ */
+class ArgBuffer
+{
+public:
+    ArgBuffer() = default;
+
+    ~ArgBuffer()
+    {
+#ifdef __linux__
+        if (mapped_size_ != 0)
+            munmap(data_, mapped_size_);
+#endif
+    }
+
+    ArgBuffer(const ArgBuffer&) = delete;
+    ArgBuffer& operator=(const ArgBuffer&) = delete;
+
+    /// @return false if the file cannot be read
+    bool load(const std::string& filename)
+    {
+#ifdef __linux__
+        int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return false;
+        struct stat st;
+        size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        if ((fstat(fd, &st) == 0) && (st.st_size > 0) && (static_cast<size_t>(st.st_size) % page_size != 0))
+        {
+            size_t size = static_cast<size_t>(st.st_size);
+            void* data = mmap(nullptr, size + 1, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED)
+            {
+                close(fd);
+                data_ = static_cast<char*>(data);
+                size_ = size;
+                mapped_size_ = size + 1;
+                return true;
+            }
+        }
+        close(fd);
+#endif
+        std::string content;
+        if (!read_file(filename, content))
+            return false;
+        assign(content.data(), content.size());
+        return true;
+    }
+
+    void assign(const char* data, size_t size)
+    {
+        buffer_.assign(data, data + size);
+        buffer_.push_back(0);
+        data_ = buffer_.data();
+        size_ = size;
+    }
+
+    char* data()
+    {
+        return data_;
+    }
+
+    size_t size() const
+    {
+        return size_;
+    }
+
+private:
+    std::vector<char> buffer_;
+    char* data_ = nullptr;
+    size_t size_ = 0;
+    size_t mapped_size_ = 0;
+};
+
+
+/// Split "data" in place into NUL terminated arguments, with quoting and escaping like in a POSIX shell
+/**
+ * Arguments are separated by unquoted whitespace, '#' at the start of an argument starts a comment.
+ * Single quotes preserve all characters, double quotes all but the escapes \", \\, \$, \` and backslash-newline.
+ * No expansions of variables, commands or globs are done.
+ * @param data the data, data[size] must be writable
+ */
+inline void split_args(char* data, size_t size, std::vector<const char*>& args)
+{
+    const char* read = data;
+    const char* end = data + size;
+    char* write = data;
+    auto is_space = [](char ch) { return (ch == ' ') || (ch == '\t') || (ch == '\n') || (ch == '\r'); };
+
+    while (read != end)
+    {
+        if (is_space(*read))
+        {
+            ++read;
+            continue;
+        }
+        if (*read == '#')
+        {
+            while ((read != end) && (*read != '\n'))
+                ++read;
+            continue;
+        }
+
+        args.push_back(write);
+        while ((read != end) && !is_space(*read))
+        {
+            char ch = *read++;
+            if (ch == '\'')
+            {
+                while ((read != end) && (*read != '\''))
+                    *write++ = *read++;
+                if (read == end)
+                    throw std::invalid_argument("unterminated single quote");
+                ++read;
+            }
+            else if (ch == '"')
+            {
+                while ((read != end) && (*read != '"'))
+                {
+                    if ((*read == '\\') && (end - read > 1) && (strchr("\"\\$`\n", read[1]) != nullptr))
+                    {
+                        ++read;
+                        if (*read++ != '\n')
+                            *write++ = read[-1];
+                    }
+                    else
+                        *write++ = *read++;
+                }
+                if (read == end)
+                    throw std::invalid_argument("unterminated double quote");
+                ++read;
+            }
+            else if ((ch == '\\') && (read != end))
+            {
+                if (*read++ != '\n')
+                    *write++ = read[-1];
+            }
+            else
+                *write++ = ch;
+        }
+        /// skip the separator, so that the terminator does not overwrite unread data.
+        /// At the end of the data the buffer has a spare byte for it.
+        if (read != end)
+            ++read;
+        *write++ = 0;
+    }
+}
+
+
+#ifdef __linux__
+/// Arguments of the current process, read once from "/proc/self/cmdline"
+class ProcCmdline
+{
+public:
+    static const ProcCmdline& instance()
+    {
+        static ProcCmdline instance;
+        return instance;
+    }
+
+    /// @return the NUL separated arguments, pointing into one buffer
+    const std::vector<const char*>& args() const
+    {
+        return args_;
+    }
+
+private:
+    ProcCmdline()
+    {
+        int fd = open("/proc/self/cmdline", O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            throw std::runtime_error(std::string("failed to open /proc/self/cmdline: ") + strerror(errno));
+        /// procfs reports a size of 0, read until EOF
+        buffer_.resize(4096);
+        size_t size = 0;
+        ssize_t len;
+        while ((len = read(fd, &buffer_[size], buffer_.size() - size)) != 0)
+        {
+            if (len < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                std::string error = strerror(errno);
+                close(fd);
+                throw std::runtime_error("failed to read /proc/self/cmdline: " + error);
+            }
+            size += static_cast<size_t>(len);
+            if (size == buffer_.size())
+                buffer_.resize(2 * size);
+        }
+        close(fd);
+
+        /// the process may have overwritten its arguments without terminating them
+        buffer_.resize(size);
+        if (buffer_.empty() || (buffer_.back() != 0))
+            buffer_.push_back(0);
+        for (size_t pos = 0; pos < buffer_.size(); pos += strlen(&buffer_[pos]) + 1)
+            args_.push_back(&buffer_[pos]);
+    }
+
+    std::vector<char> buffer_;
+    std::vector<const char*> args_;
+};
+#endif
+
+
+/// Append a unicode code point utf-8 encoded
+inline void append_utf8(std::string& out, unsigned code)
+{
+    if (code < 0x80)
+        out += static_cast<char>(code);
+    else if (code < 0x800)
+    {
+        out += static_cast<char>(0xC0 | (code >> 6));
+        out += static_cast<char>(0x80 | (code & 0x3F));
+    }
+    else if (code < 0x10000)
+    {
+        out += static_cast<char>(0xE0 | (code >> 12));
+        out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (code & 0x3F));
+    }
+    else
+    {
+        out += static_cast<char>(0xF0 | (code >> 18));
+        out += static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+        out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (code & 0x3F));
+    }
+}
+
+
+/// Parse a fixed number of hex digits
+/// @return false if there are not enough or invalid digits
+inline bool parse_hex(const char*& pos, const char* end, int digits, unsigned& code)
+{
+    if (end - pos < digits)
+        return false;
+    code = 0;
+    for (int n = 0; n < digits; ++n, ++pos)
+    {
+        char ch = *pos;
+        code <<= 4;
+        if ((ch >= '0') && (ch <= '9'))
+            code |= static_cast<unsigned>(ch - '0');
+        else if ((ch >= 'a') && (ch <= 'f'))
+            code |= static_cast<unsigned>(ch - 'a' + 10);
+        else if ((ch >= 'A') && (ch <= 'F'))
+            code |= static_cast<unsigned>(ch - 'A' + 10);
+        else
+            return false;
+    }
+    return true;
+}
+
+
+/// Streaming json parser
+/**
+ * Walks json data in a single pass without building a DOM and calls
+ * "callback(path, value, quoted)" for every scalar except null. The path
+ * is the dot separated list of object keys, value is the unescaped string
+ * or the literal number, true or false.
+ */
+template <typename Callback>
+class JsonParser
+{
+public:
+    JsonParser(const char* data, size_t size, Callback& callback) : begin_(data), pos_(data), end_(data + size), depth_(0), callback_(callback)
+    {
+    }
+
+    void parse()
+    {
+        parse_value();
+        skip_whitespace();
+        if (pos_ != end_)
+            error("unexpected data after value");
+    }
+
+private:
+    void error(const std::string& message) const
+    {
+        throw std::invalid_argument("invalid json at offset " + std::to_string(pos_ - begin_) + ": " + message);
+    }
+
+    void skip_whitespace()
+    {
+        while ((pos_ != end_) && ((*pos_ == ' ') || (*pos_ == '\t') || (*pos_ == '\n') || (*pos_ == '\r')))
+            ++pos_;
+    }
+
+    void expect(char ch)
+    {
+        skip_whitespace();
+        if ((pos_ == end_) || (*pos_ != ch))
+            error(std::string("expected '") + ch + "'");
+        ++pos_;
+    }
+
+    void parse_value()
+    {
+        const size_t max_depth = 512;
+        skip_whitespace();
+        if (pos_ == end_)
+            error("unexpected end of data");
+
+        if ((*pos_ == '{') || (*pos_ == '['))
+        {
+            if (++depth_ > max_depth)
+                error("nesting too deep");
+            if (*pos_ == '{')
+                parse_object();
+            else
+                parse_array();
+            --depth_;
+        }
+        else if (*pos_ == '"')
+        {
+            parse_string(value_);
+            if (!path_.empty())
+                callback_(path_, value_, true);
+        }
+        else if ((*pos_ == '-') || std::isdigit(static_cast<unsigned char>(*pos_)))
+        {
+            const char* start = pos_;
+            parse_number();
+            value_.assign(start, pos_);
+            if (!path_.empty())
+                callback_(path_, value_, false);
+        }
+        else
+        {
+            const char* start = pos_;
+            while ((pos_ != end_) && std::isalpha(static_cast<unsigned char>(*pos_)))
+                ++pos_;
+            if (pos_ == start)
+                error("unexpected character");
+            value_.assign(start, pos_);
+            if ((value_ != "true") && (value_ != "false") && (value_ != "null"))
+            {
+                pos_ = start;
+                error("invalid literal");
+            }
+            if ((value_ != "null") && !path_.empty())
+                callback_(path_, value_, false);
+        }
+    }
+
+    /// -?(0|[1-9][0-9]*)(\.[0-9]+)?([eE][+-]?[0-9]+)?
+    void parse_number()
+    {
+        auto digits = [this]() {
+            const char* start = pos_;
+            while ((pos_ != end_) && std::isdigit(static_cast<unsigned char>(*pos_)))
+                ++pos_;
+            if (pos_ == start)
+                error("invalid number");
+            return static_cast<size_t>(pos_ - start);
+        };
+
+        if (*pos_ == '-')
+            ++pos_;
+        const char* integer = pos_;
+        if ((digits() > 1) && (*integer == '0'))
+            error("invalid number");
+        if ((pos_ != end_) && (*pos_ == '.'))
+        {
+            ++pos_;
+            digits();
+        }
+        if ((pos_ != end_) && ((*pos_ == 'e') || (*pos_ == 'E')))
+        {
+            ++pos_;
+            if ((pos_ != end_) && ((*pos_ == '+') || (*pos_ == '-')))
+                ++pos_;
+            digits();
+        }
+    }
+
+    void parse_object()
+    {
+        ++pos_;
+        skip_whitespace();
+        if ((pos_ != end_) && (*pos_ == '}'))
+        {
+            ++pos_;
+            return;
+        }
+
+        size_t path_size = path_.size();
+        while (true)
+        {
+            skip_whitespace();
+            if ((pos_ == end_) || (*pos_ != '"'))
+                error("expected key");
+            parse_string(key_);
+            path_.resize(path_size);
+            if (!path_.empty())
+                path_ += '.';
+            path_ += key_;
+            expect(':');
+            parse_value();
+            skip_whitespace();
+            if ((pos_ != end_) && (*pos_ == ','))
+            {
+                ++pos_;
+                continue;
+            }
+            expect('}');
+            break;
+        }
+        path_.resize(path_size);
+    }
+
+    void parse_array()
+    {
+        ++pos_;
+        skip_whitespace();
+        if ((pos_ != end_) && (*pos_ == ']'))
+        {
+            ++pos_;
+            return;
+        }
+
+        while (true)
+        {
+            parse_value();
+            skip_whitespace();
+            if ((pos_ != end_) && (*pos_ == ','))
+            {
+                ++pos_;
+                continue;
+            }
+            expect(']');
+            break;
+        }
+    }
+
+    unsigned parse_hex4()
+    {
+        unsigned code;
+        if (!parse_hex(pos_, end_, 4, code))
+            error("invalid unicode escape");
+        return code;
+    }
+
+    void parse_string(std::string& out)
+    {
+        out.clear();
+        ++pos_;
+        while (true)
+        {
+            const char* start = pos_;
+            while ((pos_ != end_) && (*pos_ != '"') && (*pos_ != '\\'))
+                ++pos_;
+            out.append(start, pos_);
+            if (pos_ == end_)
+                error("unterminated string");
+            if (*pos_++ == '"')
+                return;
+
+            if (pos_ == end_)
+                error("unterminated string");
+            char ch = *pos_++;
+            switch (ch)
+            {
+                case 'b':
+                    out += '\b';
+                    break;
+                case 'f':
+                    out += '\f';
+                    break;
+                case 'n':
+                    out += '\n';
+                    break;
+                case 'r':
+                    out += '\r';
+                    break;
+                case 't':
+                    out += '\t';
+                    break;
+                case 'u':
+                {
+                    unsigned code = parse_hex4();
+                    if ((code >= 0xDC00) && (code <= 0xDFFF))
+                        error("unpaired low surrogate");
+                    if ((code >= 0xD800) && (code <= 0xDBFF))
+                    {
+                        if ((end_ - pos_ < 6) || (pos_[0] != '\\') || (pos_[1] != 'u'))
+                            error("unpaired high surrogate");
+                        pos_ += 2;
+                        unsigned low = parse_hex4();
+                        if ((low < 0xDC00) || (low > 0xDFFF))
+                            error("invalid low surrogate");
+                        code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                    }
+                    append_utf8(out, code);
+                    break;
+                }
+                case '"':
+                case '\\':
+                case '/':
+                    out += ch;
+                    break;
+                default:
+                    error(std::string("invalid escape '\\") + ch + "'");
+            }
+        }
+    }
+
+    const char* begin_;
+    const char* pos_;
+    const char* end_;
+    size_t depth_;
+    std::string path_;
+    std::string key_;
+    std::string value_;
+    Callback& callback_;
+};
+
+
+/// Streaming toml parser
+/**
+ * Walks toml data in a single pass and calls "callback(path, value, quoted)" for every scalar.
+ * The path is the dot separated list of table names and keys, value is the unescaped string
+ * or the literal. Integers are normalized to decimal without '_' separators.
+ * Arrays call the callback for each element, arrays of tables are handled like tables.
+ */
+template <typename Callback>
+class TomlParser
+{
+public:
+    TomlParser(const char* data, size_t size, Callback& callback) : begin_(data), pos_(data), end_(data + size), callback_(callback)
+    {
+    }
+
+    void parse()
+    {
+        std::string table;
+        while (true)
+        {
+            skip_whitespace(true);
+            if (pos_ == end_)
+                break;
+
+            if (*pos_ == '[')
+            {
+                ++pos_;
+                bool array_table = (pos_ != end_) && (*pos_ == '[');
+                if (array_table)
+                    ++pos_;
+                table = parse_key();
+                expect(']');
+                if (array_table)
+                    expect(']');
+            }
+            else
+            {
+                std::string key = parse_key();
+                expect('=');
+                parse_value(table.empty() ? key : table + "." + key);
+            }
+
+            skip_whitespace(false);
+            if ((pos_ != end_) && (*pos_ != '\n') && (*pos_ != '\r'))
+                error("expected end of line");
+        }
+    }
+
+private:
+    void error(const std::string& message) const
+    {
+        throw std::invalid_argument("invalid toml in line " + std::to_string(std::count(begin_, pos_, '\n') + 1) + ": " + message);
+    }
+
+    /// skip whitespace and comments, and newlines if "newlines" is true
+    void skip_whitespace(bool newlines)
+    {
+        while (pos_ != end_)
+        {
+            if ((*pos_ == ' ') || (*pos_ == '\t') || (newlines && ((*pos_ == '\n') || (*pos_ == '\r'))))
+                ++pos_;
+            else if (*pos_ == '#')
+                while ((pos_ != end_) && (*pos_ != '\n'))
+                    ++pos_;
+            else
+                break;
+        }
+    }
+
+    void expect(char ch)
+    {
+        skip_whitespace(false);
+        if ((pos_ == end_) || (*pos_ != ch))
+            error(std::string("expected '") + ch + "'");
+        ++pos_;
+    }
+
+    bool starts_with(const char* token) const
+    {
+        size_t size = strlen(token);
+        return (static_cast<size_t>(end_ - pos_) >= size) && (strncmp(pos_, token, size) == 0);
+    }
+
+    /// dotted key of bare and quoted keys
+    std::string parse_key()
+    {
+        std::string key;
+        while (true)
+        {
+            skip_whitespace(false);
+            if (!key.empty())
+                key += '.';
+            if ((pos_ != end_) && ((*pos_ == '"') || (*pos_ == '\'')))
+            {
+                std::string quoted;
+                parse_string(quoted);
+                key += quoted;
+            }
+            else
+            {
+                const char* start = pos_;
+                while ((pos_ != end_) && (std::isalnum(static_cast<unsigned char>(*pos_)) || (*pos_ == '_') || (*pos_ == '-')))
+                    ++pos_;
+                if (pos_ == start)
+                    error("expected key");
+                key.append(start, pos_);
+            }
+            skip_whitespace(false);
+            if ((pos_ == end_) || (*pos_ != '.'))
+                return key;
+            ++pos_;
+        }
+    }
+
+    void parse_value(const std::string& path)
+    {
+        skip_whitespace(false);
+        if (pos_ == end_)
+            error("expected value");
+
+        if ((*pos_ == '"') || (*pos_ == '\''))
+        {
+            parse_string(value_);
+            callback_(path, value_, true);
+        }
+        else if (*pos_ == '[')
+        {
+            ++pos_;
+            while (true)
+            {
+                skip_whitespace(true);
+                if ((pos_ != end_) && (*pos_ == ']'))
+                    break;
+                parse_value(path);
+                skip_whitespace(true);
+                if ((pos_ == end_) || (*pos_ != ','))
+                    break;
+                ++pos_;
+            }
+            skip_whitespace(true);
+            expect(']');
+        }
+        else if (*pos_ == '{')
+        {
+            ++pos_;
+            skip_whitespace(false);
+            if ((pos_ != end_) && (*pos_ == '}'))
+            {
+                ++pos_;
+                return;
+            }
+            while (true)
+            {
+                std::string key = parse_key();
+                expect('=');
+                parse_value(path + "." + key);
+                skip_whitespace(false);
+                if ((pos_ == end_) || (*pos_ != ','))
+                    break;
+                ++pos_;
+            }
+            expect('}');
+        }
+        else
+        {
+            parse_literal(value_);
+            callback_(path, value_, false);
+        }
+    }
+
+    /// numbers, booleans and date-times
+    void parse_literal(std::string& out)
+    {
+        const char* start = pos_;
+        while ((pos_ != end_) && (std::isalnum(static_cast<unsigned char>(*pos_)) || (strchr("+-_.:", *pos_) != nullptr)))
+        {
+            ++pos_;
+            /// date and time may be separated by a space
+            if ((pos_ - start == 10) && (start[4] == '-') && (start[7] == '-') && (end_ - pos_ > 1) && (*pos_ == ' ') &&
+                std::isdigit(static_cast<unsigned char>(pos_[1])))
+                ++pos_;
+        }
+        if (pos_ == start)
+            error("expected value");
+        out.assign(start, pos_);
+        if (!is_literal(out))
+        {
+            pos_ = start;
+            error("invalid value '" + out + "'");
+        }
+
+        bool is_date = (out.size() > 4) && (out[4] == '-');
+        if (!is_date && (out.find_first_of("0123456789") != std::string::npos))
+        {
+            out.erase(std::remove(out.begin(), out.end(), '_'), out.end());
+            if ((out.size() > 2) && (out[0] == '0') && ((out[1] == 'x') || (out[1] == 'o') || (out[1] == 'b')))
+            {
+                char* end = nullptr;
+                unsigned long long value = std::strtoull(out.c_str() + 2, &end, out[1] == 'x' ? 16 : (out[1] == 'o' ? 8 : 2));
+                if (*end != 0)
+                    error("invalid integer");
+                out = std::to_string(value);
+            }
+        }
+    }
+
+    /// Booleans, integers, floats (including inf and nan) and date-times as defined by TOML 1.0
+    static bool is_literal(const std::string& literal)
+    {
+        if ((literal == "true") || (literal == "false"))
+            return true;
+
+        const char* pos = literal.c_str();
+        if (match(pos, "dddd-dd-dd"))
+        {
+            if (*pos == 0)
+                return true;
+            if ((*pos != 'T') && (*pos != 't') && (*pos != ' '))
+                return false;
+            ++pos;
+            if (!match_time(pos))
+                return false;
+            if ((*pos == 'Z') || (*pos == 'z'))
+                ++pos;
+            else if (((*pos == '+') || (*pos == '-')) && !match(++pos, "dd:dd"))
+                return false;
+            return *pos == 0;
+        }
+        if (match_time(pos))
+            return *pos == 0;
+
+        if ((pos[0] == '0') && ((pos[1] == 'x') || (pos[1] == 'o') || (pos[1] == 'b')))
+        {
+            int base = (pos[1] == 'x') ? 16 : ((pos[1] == 'o') ? 8 : 2);
+            pos += 2;
+            return match_digits(pos, base) && (*pos == 0);
+        }
+
+        if ((*pos == '+') || (*pos == '-'))
+            ++pos;
+        if ((strcmp(pos, "inf") == 0) || (strcmp(pos, "nan") == 0))
+            return true;
+        /// no leading zeros
+        if (*pos == '0')
+            ++pos;
+        else if (!match_digits(pos, 10))
+            return false;
+        if ((*pos == '.') && !match_digits(++pos, 10))
+            return false;
+        if ((*pos == 'e') || (*pos == 'E'))
+        {
+            ++pos;
+            if ((*pos == '+') || (*pos == '-'))
+                ++pos;
+            if (!match_digits(pos, 10))
+                return false;
+        }
+        return *pos == 0;
+    }
+
+    /// Match "pattern" at "pos", where 'd' matches any digit. "pos" is advanced only on a match
+    static bool match(const char*& pos, const char* pattern)
+    {
+        const char* iter = pos;
+        for (; *pattern != 0; ++pattern, ++iter)
+        {
+            if ((*pattern == 'd') ? !std::isdigit(static_cast<unsigned char>(*iter)) : (*iter != *pattern))
+                return false;
+        }
+        pos = iter;
+        return true;
+    }
+
+    /// hh:mm:ss with optional fraction
+    static bool match_time(const char*& pos)
+    {
+        if (!match(pos, "dd:dd:dd"))
+            return false;
+        return (*pos != '.') || match_digits(++pos, 10);
+    }
+
+    /// digits of "base", single underscores between digits are allowed
+    static bool match_digits(const char*& pos, int base)
+    {
+        auto is_digit = [base](char ch) {
+            return (base == 16) ? (std::isxdigit(static_cast<unsigned char>(ch)) != 0) : ((ch >= '0') && (ch < '0' + base));
+        };
+        if (!is_digit(*pos))
+            return false;
+        ++pos;
+        while (is_digit(*pos) || ((*pos == '_') && is_digit(pos[1])))
+            pos += (*pos == '_') ? 2 : 1;
+        return true;
+    }
+
+    void parse_string(std::string& out)
+    {
+        out.clear();
+        char quote = *pos_;
+        bool multi_line = starts_with(quote == '"' ? "\"\"\"" : "'''");
+        pos_ += multi_line ? 3 : 1;
+        /// a newline immediately following the opening delimiter is trimmed
+        if (multi_line && starts_with("\r\n"))
+            pos_ += 2;
+        else if (multi_line && starts_with("\n"))
+            ++pos_;
+
+        while (true)
+        {
+            if (pos_ == end_)
+                error("unterminated string");
+            char ch = *pos_;
+            if (ch == quote)
+            {
+                if (!multi_line)
+                {
+                    ++pos_;
+                    return;
+                }
+                if (starts_with(quote == '"' ? "\"\"\"" : "'''"))
+                {
+                    /// up to two additional quotes belong to the string
+                    pos_ += 3;
+                    for (int n = 0; (n < 2) && (pos_ != end_) && (*pos_ == quote); ++n, ++pos_)
+                        out += quote;
+                    return;
+                }
+            }
+            else if (!multi_line && (ch == '\n'))
+                error("newline in string");
+
+            ++pos_;
+            if ((ch != '\\') || (quote == '\''))
+            {
+                out += ch;
+                continue;
+            }
+
+            if (pos_ == end_)
+                error("unterminated string");
+            ch = *pos_++;
+            unsigned code;
+            switch (ch)
+            {
+                case 'b':
+                    out += '\b';
+                    break;
+                case 't':
+                    out += '\t';
+                    break;
+                case 'n':
+                    out += '\n';
+                    break;
+                case 'f':
+                    out += '\f';
+                    break;
+                case 'r':
+                    out += '\r';
+                    break;
+                case 'e':
+                    out += '\x1b';
+                    break;
+                case 'u':
+                case 'U':
+                    if (!parse_hex(pos_, end_, ch == 'u' ? 4 : 8, code))
+                        error("invalid unicode escape");
+                    append_utf8(out, code);
+                    break;
+                case '"':
+                case '\\':
+                    out += ch;
+                    break;
+                default:
+                    /// line ending backslash: trim whitespace and newlines
+                    if (!multi_line || ((ch != ' ') && (ch != '\t') && (ch != '\r') && (ch != '\n')))
+                        error(std::string("invalid escape sequence '\\") + ch + "'");
+                    while ((pos_ != end_) && ((*pos_ == ' ') || (*pos_ == '\t') || (*pos_ == '\r') || (*pos_ == '\n')))
+                        ++pos_;
+            }
+        }
+    }
+
+    const char* begin_;
+    const char* pos_;
+    const char* end_;
+    std::string value_;
+    Callback& callback_;
+};
+
+
+/// Process wide cache of tokenized ini files, shared by all OptionParsers
+/**
+ * Ini files are read and tokenized once per process. A cached file is
+ * tokenized again when its size, modification time or inode changes.
+ */
+class IniCache
+{
+public:
+    static IniCache& instance()
+    {
+        static IniCache cache;
+        return cache;
+    }
+
+    /// Get a tokenized ini file
+    /// @param filename the ini file's name
+    /// @return the tokenized file or nullptr if the file does not exist
+    std::shared_ptr<const IniDocument> get(const std::string& filename)
+    {
+        FileStamp stamp;
+        if (!file_stamp(filename, stamp))
+            return nullptr;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto iter = documents_.find(filename);
+            if ((iter != documents_.end()) && (iter->second->stamp == stamp))
+                return iter->second;
+        }
+
+        std::ifstream file(filename.c_str());
+        auto document = tokenize_ini(file);
+        document->stamp = stamp;
+        std::lock_guard<std::mutex> lock(mutex_);
+        documents_[filename] = document;
+        return document;
+    }
+
+    /// Read and tokenize files, in parallel if POPL_THREADS is defined
+    /// @param filenames the ini files
+    void prefetch(const std::vector<std::string>& filenames)
+    {
+        std::atomic<size_t> next(0);
+        auto tokenize = [this, &filenames, &next]() {
+            for (size_t n = next++; n < filenames.size(); n = next++)
+            {
+                try
+                {
+                    get(filenames[n]);
+                }
+                catch (...)
+                {
+                    /// errors are reported when the file is parsed
+                }
+            }
+        };
+        run_workers(filenames.size(), tokenize);
+    }
+
+    /// Remove all tokenized files from the cache
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        documents_.clear();
+    }
+
+private:
+    std::mutex mutex_;
+    std::map<std::string, std::shared_ptr<const IniDocument>> documents_;
+};
+
+
+
+/// Expands references in ini values
+/**
+ * "${section.key}" is replaced by the (expanded) value of the key, "${env:NAME}" by the
+ * environment variable NAME and "${nproc}" by the number of hardware threads. "$${" is a literal "${".
+ * Referenced keys are looked up in the tokenized documents on demand, expanded keys are memoized,
+ * cyclic references are detected.
+ */
+class IniInterpolator
+{
+public:
+    /// Constructor
+    /// @param documents the tokenized ini files in order of parsing. Later keys override earlier ones.
+    /// @param profile keys of "[profile.NAME.section]" override keys of "[section]" for this profile NAME
+    IniInterpolator(std::vector<std::shared_ptr<const IniDocument>> documents, const std::string& profile = "")
+        : documents_(std::move(documents)), overlay_(profile.empty() ? "" : "profile." + profile + "."), environment_(false)
+    {
+    }
+
+    /// Check if an expansion depends on the environment ("${env:NAME}" or "${nproc}")
+    /// @return true if the environment has been used
+    bool environment() const
+    {
+        return environment_;
+    }
+
+    /// Expand all references in a value
+    /// @param value the value
+    /// @return the expanded value
+    std::string expand(const std::string& value)
+    {
+        std::string result;
+        size_t pos = 0;
+        for (size_t start = value.find('$'); start != std::string::npos; start = value.find('$', pos))
+        {
+            if (value.compare(start, 3, "$${") == 0)
+            {
+                result.append(value, pos, start - pos);
+                result.append("${");
+                pos = start + 3;
+                continue;
+            }
+            if (value.compare(start, 2, "${") != 0)
+            {
+                result.append(value, pos, start + 1 - pos);
+                pos = start + 1;
+                continue;
+            }
+            size_t end = value.find('}', start + 2);
+            if (end == std::string::npos)
+                break;
+            result.append(value, pos, start - pos);
+            result.append(lookup(value.substr(start + 2, end - start - 2)));
+            pos = end + 1;
+        }
+        result.append(value, pos, std::string::npos);
+        return result;
+    }
+
+private:
+    /// Find the last value of a key
+    /// @return the value or nullptr if the key is not defined
+    const std::string* find(const std::string& name) const
+    {
+        for (auto document = documents_.rbegin(); document != documents_.rend(); ++document)
+        {
+            for (auto section = (*document)->sections.rbegin(); section != (*document)->sections.rend(); ++section)
+            {
+                /// name is "key" for keys outside of any section, otherwise "section.key"
+                size_t prefix = section->name.empty() ? 0 : section->name.size() + 1;
+                if ((name.size() <= prefix) || ((prefix != 0) && ((name.compare(0, prefix - 1, section->name) != 0) || (name[prefix - 1] != '.'))))
+                    continue;
+                for (size_t n = section->end; n-- > section->begin;)
+                {
+                    const auto& entry = (*document)->entries[n];
+                    if (name.compare(prefix, std::string::npos, entry.first) == 0)
+                        return &entry.second;
+                }
+            }
+        }
+        return nullptr;
+    }
+
+    std::string lookup(const std::string& name)
+    {
+        if (name.compare(0, 4, "env:") == 0)
+        {
+            environment_ = true;
+            const char* env = std::getenv(name.c_str() + 4);
+            if (env == nullptr)
+                throw std::invalid_argument("undefined environment variable: \"" + name.substr(4) + "\"");
+            return env;
+        }
+
+        auto expanded = expanded_.find(name);
+        if (expanded != expanded_.end())
+            return expanded->second;
+
+        const std::string* value = overlay_.empty() ? nullptr : find(overlay_ + name);
+        if (value == nullptr)
+            value = find(name);
+        if (value == nullptr)
+        {
+            if (name == "nproc")
+            {
+                environment_ = true;
+                return std::to_string(std::max(1u, std::thread::hardware_concurrency()));
+            }
+            throw std::invalid_argument("undefined reference: \"${" + name + "}\"");
+        }
+
+        if (!expanding_.insert(name).second)
+            throw std::invalid_argument("cyclic reference: \"${" + name + "}\"");
+        std::string result = expand(*value);
+        expanding_.erase(name);
+        expanded_[name] = result;
+        return result;
+    }
+
+    std::vector<std::shared_ptr<const IniDocument>> documents_;
+    std::string overlay_;
+    bool environment_;
+    std::unordered_map<std::string, std::string> expanded_;
+    std::set<std::string> expanding_;
+};
+
+} // namespace detail
+
+
+
+/// Option implementation /////////////////////////////////
+
+inline Option::Option(const std::string& short_name, const std::string& long_name, std::string description)
+    : short_name_(short_name), long_name_(long_name), description_(std::move(description)), attribute_(Attribute::optional)
+{
+    if (short_name.size() > 1)
+        throw std::invalid_argument("length of short name must be <= 1: '" + short_name + "'");
+
+    if (short_name.empty() && long_name.empty())
+        throw std::invalid_argument("short and long name are empty");
+}
+
+
+inline char Option::short_name() const
+{
+    if (!short_name_.empty())
+        return short_name_[0];
+    return 0;
+}
+
+
+inline std::string Option::long_name() const
+{
+    return long_name_;
+}
+
+
+inline std::string Option::name(OptionName what_name, bool with_hypen) const
+{
+    if (what_name == OptionName::short_name)
+        return short_name_.empty() ? "" : ((with_hypen ? "-" : "") + short_name_);
+    if (what_name == OptionName::long_name)
+        return long_name_.empty() ? "" : ((with_hypen ? "--" : "") + long_name_);
+    return "";
+}
+
+
+inline std::string Option::description() const
+{
+    return description_;
+}
+
+
+inline void Option::set_attribute(const Attribute& attribute)
+{
+    attribute_ = attribute;
+}
+
+
+inline Attribute Option::attribute() const
+{
+    return attribute_;
+}
+
+
+inline bool Option::get_value(std::ostream& /*out*/, size_t /*idx*/) const
+{
+    return false;
+}
+
+
+inline std::shared_ptr<Option> Option::clone() const
+{
+    return nullptr;
+}
+
+
+inline bool Option::replace_values(const std::vector<size_t>& /*positions*/, const Option& /*values*/)
+{
+    return false;
+}
+
+
+
+/// Value implementation /////////////////////////////////
+
+template <class T>
+inline Value<T>::Value(const std::string& short_name, const std::string& long_name, const std::string& description)
+    : Option(short_name, long_name, description), assign_to_(nullptr)
+{
+}
+
+
+template <class T>
+inline Value<T>::Value(const std::string& short_name, const std::string& long_name, const std::string& description, const T& default_val, T* assign_to)
+    : Value<T>(short_name, long_name, description)
+{
+    assign_to_ = assign_to;
+    set_default(default_val);
+}
+
+
+template <class T>
+inline size_t Value<T>::count() const
+{
+    return values_.size();
+}
+
+
+template <class T>
+inline bool Value<T>::is_set() const
+{
+    return !values_.empty();
+}
 
 
 template <class T>
-inline size_t Value<T>::count() const
+inline void Value<T>::assign_to(T* var)
+{
+    assign_to_ = var;
+    update_reference();
+}
+
+
+template <class T>
+inline void Value<T>::set_value(const T& value)
+{
+    clear();
+    add_value(value);
+}
+
+template <class T>
+inline T Value<T>::value_or(const T& default_value, size_t idx) const
+{
+    if (idx < values_.size())
+        return values_[idx];
+    else if (default_)
+        return *default_;
+    else
+        return default_value;
+}
+
+template <class T>
+inline T Value<T>::value(size_t idx) const
+{
+    if (!this->is_set() && default_)
+        return *default_;
+
+    if (!is_set() || (idx >= count()))
+    {
+        std::stringstream optionStr;
+        if (!is_set())
+            optionStr << "option not set: \"";
+        else
+            optionStr << "index out of range (" << idx << ") for \"";
+
+        if (short_name() != 0)
+            optionStr << "-" << short_name();
+        else
+            optionStr << "--" << long_name();
+
+        optionStr << "\"";
+        throw std::out_of_range(optionStr.str());
+    }
+
+    return values_[idx];
+}
+
+
+
+template <class T>
+inline void Value<T>::set_default(const T& value)
+{
+    this->default_.reset(new T);
+    *this->default_ = value;
+    update_reference();
+}
+
+
+template <class T>
+inline bool Value<T>::has_default() const
+{
+    return (this->default_ != nullptr);
+}
+
+
+template <class T>
+inline T Value<T>::get_default() const
+{
+    if (!has_default())
+        throw std::runtime_error("no default value set");
+    return *this->default_;
+}
+
+
+template <class T>
+inline bool Value<T>::get_default(std::ostream& out) const
+{
+    if (!has_default())
+        return false;
+    detail::write_value(out, *this->default_, std::is_floating_point<T>());
+    return true;
+}
+
+
+template <class T>
+inline bool Value<T>::get_value(std::ostream& out, size_t idx) const
+{
+    if (idx >= values_.size())
+        return false;
+    detail::write_value(out, values_[idx], std::is_floating_point<T>());
+    return true;
+}
+
+
+template <class T>
+inline Argument Value<T>::argument_type() const
+{
+    return Argument::required;
+}
+
+
+template <class T>
+inline std::shared_ptr<Option> Value<T>::clone() const
+{
+    /// a copy of a derived type would be sliced
+    if (typeid(*this) != typeid(Value<T>))
+        return nullptr;
+    auto option = std::make_shared<Value<T>>(short_name_, long_name_, description_);
+    if (default_)
+        option->set_default(*default_);
+    option->set_attribute(attribute_);
+    option->values_ = values_;
+    return option;
+}
+
+
+template <>
+inline std::string Value<std::string>::convert(OptionName what_name, const char* value) const
+{
+    if ((value == nullptr) || (strlen(value) == 0))
+        throw invalid_option(this, invalid_option::Error::missing_argument, what_name, "", "missing argument for " + name(what_name, true));
+
+    return value;
+}
+
+
+template <>
+inline bool Value<bool>::convert(OptionName /*what_name*/, const char* value) const
+{
+    return ((value != nullptr) && ((strcmp(value, "1") == 0) || (strcmp(value, "true") == 0) || (strcmp(value, "True") == 0) || (strcmp(value, "TRUE") == 0)));
+}
+
+
+template <class T>
+inline void Value<T>::parse(OptionName what_name, const char* value)
+{
+    this->add_value(convert(what_name, value));
+}
+
+
+template <class T>
+inline T Value<T>::convert(OptionName what_name, const char* value) const
+{
+    T parsed_value;
+    std::string strValue;
+    if (value != nullptr)
+        strValue = value;
+
+    std::istringstream is(strValue);
+    int valuesRead = 0;
+    while (is.good())
+    {
+        if (is.peek() != EOF)
+            is >> parsed_value;
+        else
+            break;
+
+        valuesRead++;
+    }
+
+    if (is.fail())
+        throw invalid_option(this, invalid_option::Error::invalid_argument, what_name, value,
+                             "invalid argument for " + name(what_name, true) + ": '" + strValue + "'");
+
+    if (valuesRead > 1)
+        throw invalid_option(this, invalid_option::Error::too_many_arguments, what_name, value,
+                             "too many arguments for " + name(what_name, true) + ": '" + strValue + "'");
+
+    if (strValue.empty())
+        throw invalid_option(this, invalid_option::Error::missing_argument, what_name, "", "missing argument for " + name(what_name, true));
+
+    return parsed_value;
+}
+
+
+template <class T>
+inline void Value<T>::update_reference()
+{
+    if (this->assign_to_)
+    {
+        if (!this->is_set() && default_)
+            *this->assign_to_ = *default_;
+        else if (this->is_set())
+            *this->assign_to_ = values_.back();
+    }
+}
+
+
+template <class T>
+inline void Value<T>::add_value(const T& value)
+{
+    values_.push_back(value);
+    update_reference();
+}
+
+
+template <class T>
+inline void Value<T>::clear()
+{
+    values_.clear();
+    update_reference();
+}
+
+
+template <class T>
+inline bool Value<T>::replace_values(const std::vector<size_t>& positions, const Option& values)
+{
+    const auto* source = dynamic_cast<const Value<T>*>(&values);
+    if (source == nullptr)
+        return false;
+
+    size_t insert_at = positions.empty() ? values_.size() : std::min(positions.front(), values_.size());
+    std::vector<T> result;
+    result.reserve(values_.size() + source->values_.size());
+    auto position = positions.begin();
+    for (size_t n = 0; n <= values_.size(); ++n)
+    {
+        if (n == insert_at)
+            result.insert(result.end(), source->values_.begin(), source->values_.end());
+        if (n == values_.size())
+            break;
+        if ((position != positions.end()) && (*position == n))
+            ++position;
+        else
+            result.push_back(values_[n]);
+    }
+    values_.swap(result);
+    update_reference();
+    return true;
+}
+
+
+
+/// Implicit implementation /////////////////////////////////
+
+template <class T>
+inline Implicit<T>::Implicit(const std::string& short_name, const std::string& long_name, const std::string& description, const T& implicit_val, T* assign_to)
+    : Value<T>(short_name, long_name, description, implicit_val, assign_to)
+{
+}
+
+
+template <class T>
+inline Argument Implicit<T>::argument_type() const
+{
+    return Argument::optional;
+}
+
+
+template <class T>
+inline std::shared_ptr<Option> Implicit<T>::clone() const
+{
+    if (typeid(*this) != typeid(Implicit<T>))
+        return nullptr;
+    auto option = std::make_shared<Implicit<T>>(this->short_name_, this->long_name_, this->description_, *this->default_);
+    option->set_attribute(this->attribute_);
+    option->values_ = this->values_;
+    return option;
+}
+
+
+template <class T>
+inline T Implicit<T>::convert(OptionName what_name, const char* value) const
+{
+    if ((value != nullptr) && (strlen(value) > 0))
+        return Value<T>::convert(what_name, value);
+    else
+        return *this->default_;
+}
+
+
+
+/// Switch implementation /////////////////////////////////
+
+inline Switch::Switch(const std::string& short_name, const std::string& long_name, const std::string& description, bool* assign_to)
+    : Value<bool>(short_name, long_name, description, false, assign_to)
+{
+}
+
+
+inline bool Switch::convert(OptionName /*what_name*/, const char* /*value*/) const
+{
+    return true;
+}
+
+
+inline Argument Switch::argument_type() const
+{
+    return Argument::no;
+}
+
+
+inline std::shared_ptr<Option> Switch::clone() const
+{
+    if (typeid(*this) != typeid(Switch))
+        return nullptr;
+    auto option = std::make_shared<Switch>(short_name_, long_name_, description_);
+    option->set_attribute(attribute_);
+    option->values_ = values_;
+    return option;
+}
+
+
+
+/// OptionParser implementation /////////////////////////////////
+
+inline OptionParser::OptionParser(std::string description) : description_(std::move(description))
+{
+}
+
+
+template <typename T, typename... Ts>
+inline std::shared_ptr<T> OptionParser::add(Ts&&... params)
+{
+    return add<T, Attribute::optional>(std::forward<Ts>(params)...);
+}
+
+
+template <typename T, Attribute attribute, typename... Ts>
+inline std::shared_ptr<T> OptionParser::add(Ts&&... params)
+{
+    static_assert(std::is_base_of<Option, typename std::decay<T>::type>::value, "type T must be Switch, Value or Implicit");
+    std::shared_ptr<T> option = std::make_shared<T>(std::forward<Ts>(params)...);
+
+    for (const auto& o : options_)
+    {
+        if ((option->short_name() != 0) && (option->short_name() == o->short_name()))
+            throw std::invalid_argument("duplicate short option name '-" + std::string(1, option->short_name()) + "'");
+        if (!option->long_name().empty() && (option->long_name() == (o->long_name())))
+            throw std::invalid_argument("duplicate long option name '--" + option->long_name() + "'");
+    }
+    option->set_attribute(attribute);
+    options_.push_back(option);
+    if (!option->long_name().empty())
+        long_names_[option->long_name()] = option;
+    return option;
+}
+
+
+inline std::string OptionParser::description() const
+{
+    return description_;
+}
+
+
+inline const std::vector<Option_ptr>& OptionParser::options() const
+{
+    return options_;
+}
+
+
+inline const std::vector<std::string>& OptionParser::non_option_args() const
+{
+    return non_option_args_;
+}
+
+
+inline const std::vector<std::string>& OptionParser::unknown_options() const
+{
+    return unknown_options_;
+}
+
+
+inline Option_ptr OptionParser::find_option(const std::string& long_name) const
+{
+    auto iter = long_names_.find(long_name);
+    if (iter == long_names_.end())
+        return nullptr;
+    return iter->second;
+}
+
+
+inline Option_ptr OptionParser::find_option(char short_name) const
+{
+    for (const auto& option : options_)
+        if (option->short_name() == short_name)
+            return option;
+    return nullptr;
+}
+
+
+inline OptionParser::LongNameIndex OptionParser::long_name_index() const
+{
+    LongNameIndex index;
+    for (const auto& option : options_)
+        if (!option->long_name_.empty() && (option->attribute() != Attribute::inactive))
+            index.emplace(detail::fnv1a(option->long_name_.data(), option->long_name_.size()), option);
+    return index;
+}
+
+
+inline Option_ptr OptionParser::find_option(const LongNameIndex& index, const std::string& section, const std::string& key) const
+{
+    /// hash and compare "section.key" piecewise, without building the string
+    uint64_t hash = detail::fnv1a(section.data(), section.size());
+    if (!section.empty())
+        hash = detail::fnv1a(".", 1, hash);
+    hash = detail::fnv1a(key.data(), key.size(), hash);
+
+    auto range = index.equal_range(hash);
+    for (auto iter = range.first; iter != range.second; ++iter)
+    {
+        const std::string& long_name = iter->second->long_name_;
+        if (section.empty())
+        {
+            if (long_name == key)
+                return iter->second;
+        }
+        else if ((long_name.size() == section.size() + 1 + key.size()) && (long_name.compare(0, section.size(), section) == 0) &&
+                 (long_name[section.size()] == '.') && (long_name.compare(section.size() + 1, key.size(), key) == 0))
+            return iter->second;
+    }
+    return nullptr;
+}
+
+
+template <typename T>
+inline std::shared_ptr<T> OptionParser::get_option(const std::string& long_name) const
+{
+    Option_ptr option = find_option(long_name);
+    if (!option)
+        throw std::invalid_argument("option not found: " + long_name);
+    auto result = std::dynamic_pointer_cast<T>(option);
+    if (!result)
+        throw std::invalid_argument("cannot cast option to T: " + long_name);
+    return result;
+}
+
+
+template <typename T>
+inline std::shared_ptr<T> OptionParser::get_option(char short_name) const
+{
+    Option_ptr option = find_option(short_name);
+    if (!option)
+        throw std::invalid_argument("option not found: " + std::string(1, short_name));
+    auto result = std::dynamic_pointer_cast<T>(option);
+    if (!result)
+        throw std::invalid_argument("cannot cast option to T: " + std::string(1, short_name));
+    return result;
+}
+
+inline const std::vector<std::string>& OptionParser::ini_files() const
+{
+    return ini_files_;
+}
+
+
+inline const std::set<std::string>& OptionParser::included_files() const
+{
+    return included_files_;
+}
+
+
+inline bool OptionParser::is_key_dir(const std::string& ini_filename) const
+{
+    return key_dirs_.find(ini_filename) != key_dirs_.end();
+}
+
+
+inline void OptionParser::parse(const std::string& ini_filename)
+{
+    std::vector<IniLine> lines;
+    std::vector<std::string> unknown_options;
+    std::vector<std::string> files;
+    parse_ini(ini_filename, lines, unknown_options, nullptr, &files);
+    apply_ini(ini_filename, lines, unknown_options, files);
+}
+
+
+inline void OptionParser::parse(std::istream& in)
+{
+    std::vector<IniLine> lines;
+    std::vector<std::string> unknown_options;
+    /// Profile overlays and references can refer to later lines, they need the whole document
+    if (profile_option_ || interpolation_)
+    {
+        parse_ini("", lines, unknown_options, detail::tokenize_ini(in));
+        apply_lines(lines, unknown_options);
+        return;
+    }
+
+    /// Otherwise every line is applied as it is read
+    IniLoad load{long_name_index(), section_prefixes(), {""}, {}, {}, {}, {}, lines, unknown_options};
+    std::string current_section;
+    bool relevant = true;
+    detail::parse_ini(in, [&](const std::string& section, const std::string& key, const std::string& value, size_t /*offset*/) {
+        if (section != current_section)
+        {
+            current_section = section;
+            relevant = section.empty() || (load.prefixes.find(section) != load.prefixes.end());
+        }
+        if (!relevant)
+        {
+            if (report_unknown_sections_)
+                unknown_options_.push_back(section + "." + key);
+            return;
+        }
+
+        Option_ptr option = find_option(load.index, section, key);
+        if (option)
+        {
+            option->parse(OptionName::long_name, value.c_str());
+            sources_[option.get()] = "ini data";
+        }
+        else if (includes_ && section.empty() && ((key == "include") || (key == "include_dir")))
+        {
+            load_include("", key, value, load);
+            apply_lines(lines, unknown_options);
+            lines.clear();
+            unknown_options.clear();
+        }
+        else
+            unknown_options_.push_back(section.empty() ? key : section + "." + key);
+    });
+}
+
+
+inline void OptionParser::parse_json(const std::string& json_filename)
+{
+    std::string content;
+    if (!detail::read_file(json_filename, content))
+        throw std::runtime_error("failed to open json file: " + json_filename);
+    parse_json(content.data(), content.size());
+}
+
+
+inline void OptionParser::parse_json(const char* data, size_t size)
+{
+    auto callback = [this](const std::string& path, const std::string& value, bool quoted) { apply_value(path, value, quoted); };
+    detail::JsonParser<decltype(callback)> parser(data, size, callback);
+    parser.parse();
+}
+
+
+inline void OptionParser::parse_toml(const std::string& toml_filename)
+{
+    std::string content;
+    if (!detail::read_file(toml_filename, content))
+        throw std::runtime_error("failed to open toml file: " + toml_filename);
+    parse_toml(content.data(), content.size());
+}
+
+
+inline void OptionParser::parse_toml(const char* data, size_t size)
+{
+    auto callback = [this](const std::string& path, const std::string& value, bool quoted) { apply_value(path, value, quoted); };
+    detail::TomlParser<decltype(callback)> parser(data, size, callback);
+    parser.parse();
+}
+
+
+inline void OptionParser::apply_value(const std::string& long_name, const std::string& value, bool quoted)
+{
+    Option_ptr option = find_option(long_name);
+    if (option && (option->attribute() == Attribute::inactive))
+        option = nullptr;
+
+    if (!option)
+        unknown_options_.push_back(long_name);
+    else if ((option->argument_type() != Argument::no) || quoted || (value != "false"))
+        option->parse(OptionName::long_name, value.c_str());
+}
+
+
+inline void OptionParser::parse_env(const std::string& prefix)
+{
+    for_each_env(prefix, [this](const Option_ptr& option, const std::string& variable, const char* value) {
+        if (!option)
+            unknown_options_.push_back(variable);
+        else if (!option->is_set())
+        {
+            option->parse(OptionName::long_name, value);
+            sources_[option.get()] = variable;
+        }
+    });
+}
+
+
+template <typename Callback>
+inline void OptionParser::for_each_env(const std::string& prefix, Callback callback) const
+{
+    auto normalize = [](char ch) { return std::isalnum(static_cast<unsigned char>(ch)) ? static_cast<char>(std::toupper(static_cast<unsigned char>(ch))) : '_'; };
+
+    std::unordered_map<std::string, Option_ptr> index;
+    for (const auto& option : options_)
+    {
+        if (option->long_name().empty() || (option->attribute() == Attribute::inactive))
+            continue;
+        std::string name(option->long_name());
+        std::transform(name.begin(), name.end(), name.begin(), normalize);
+        index.emplace(std::move(name), option);
+    }
+
+    std::string name;
+    for (char** env = POPL_ENVIRON; (env != nullptr) && (*env != nullptr); ++env)
+    {
+        const char* variable = *env;
+        if (strncmp(variable, prefix.c_str(), prefix.size()) != 0)
+            continue;
+        const char* equal = strchr(variable, '=');
+        if ((equal == nullptr) || (equal < variable + prefix.size()))
+            continue;
+
+        name.assign(variable + prefix.size(), equal);
+        std::transform(name.begin(), name.end(), name.begin(), normalize);
+        auto iter = index.find(name);
+        const char* value = equal + 1;
+        if (iter == index.end())
+            callback(nullptr, std::string(variable, equal), value);
+        else if ((iter->second->argument_type() != Argument::no) || ((strcmp(value, "0") != 0) && (strcmp(value, "false") != 0)))
+            callback(iter->second, std::string(variable, equal), value);
+    }
+}
+
+
+inline void OptionParser::parse(const char* data, size_t size)
+{
+    detail::MemoryStreamBuf buffer(data, size);
+    std::istream in(&buffer);
+    parse(in);
+}
+
+
+inline void OptionParser::parse(const std::string& ini_filename, const std::string& cache_filename)
+{
+    static const char magic[] = "POPLINI2";
+    detail::FileStamp stamp;
+    bool have_stamp = detail::file_stamp(ini_filename, stamp);
+    /// the cached lines depend on the added Options and on the settings of the ini loader
+    std::string settings{includes_ ? '1' : '0', interpolation_ ? '1' : '0', report_unknown_sections_ ? '1' : '0'};
+    if (profile_option_)
+        settings += "profile=" + select_profile(ini_lines_, {});
+    uint64_t schema = detail::fnv1a(settings.data(), settings.size(), schema_hash());
+
+    std::vector<IniLine> lines;
+    std::vector<std::string> unknown_options;
+    std::vector<std::string> files;
+    std::string cache;
+    /// the cache is valid if the stamps of the ini file and of all included files and directories are unchanged
+    auto load_cache = [&]() {
+        const char* pos = cache.data();
+        const char* end = pos + cache.size();
+        uint64_t cached_schema;
+        if (cache.compare(0, 8, magic) != 0)
+            return false;
+        pos += 8;
+        if (!detail::get(pos, end, cached_schema) || (cached_schema != schema) || !detail::get(pos, end, files))
+            return false;
+        for (const auto& file : files)
+        {
+            detail::FileStamp cached;
+            detail::FileStamp current;
+            if (!detail::get(pos, end, cached.size) || !detail::get(pos, end, cached.mtime) || !detail::get(pos, end, cached.inode) ||
+                !detail::file_stamp(file, current) || !(cached == current))
+                return false;
+        }
+
+        if (!read_lines(pos, end, lines) || !detail::get(pos, end, unknown_options))
+            return false;
+        return pos == end;
+    };
+
+    if (!have_stamp || !detail::read_file(cache_filename, cache) || !load_cache())
+    {
+        lines.clear();
+        unknown_options.clear();
+        files.clear();
+        /// values that are expanded from the environment are not cached, the environment can change with every run
+        bool cacheable = parse_ini(ini_filename, lines, unknown_options, nullptr, &files);
+        if (!cacheable)
+            std::remove(cache_filename.c_str());
+
+        /// stamps are taken after parsing: a file modified meanwhile invalidates the cache on the next run
+        std::vector<detail::FileStamp> stamps(files.size());
+        for (size_t n = 0; (n < files.size()) && have_stamp; ++n)
+            have_stamp = detail::file_stamp(files[n], stamps[n]);
+
+        if (have_stamp && cacheable)
+        {
+            cache.assign(magic, 8);
+            detail::put(cache, schema);
+            detail::put(cache, files);
+            for (const auto& file_stamp : stamps)
+            {
+                detail::put(cache, file_stamp.size);
+                detail::put(cache, file_stamp.mtime);
+                detail::put(cache, file_stamp.inode);
+            }
+            write_lines(cache, lines);
+            detail::put(cache, unknown_options);
+
+            /// write to a temporary file and rename it, so that concurrent readers never see a partial cache
+            /// the cache is optional: failing to write it is not an error
+            std::string tmp_filename = cache_filename + ".tmp";
+            {
+                std::ofstream file(tmp_filename.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+                file.write(cache.data(), static_cast<std::streamsize>(cache.size()));
+            }
+            std::remove(cache_filename.c_str());
+            std::rename(tmp_filename.c_str(), cache_filename.c_str());
+        }
+    }
+
+    apply_ini(ini_filename, lines, unknown_options, files);
+}
+
+
+inline void OptionParser::parse_dir(const std::string& directory, const std::string& extension)
+{
+    std::vector<std::string> files = detail::list_files(directory, extension);
+    std::sort(files.begin(), files.end());
+
+    /// read and tokenize in parallel into the process wide ini cache and apply sequentially for a deterministic precedence
+    detail::IniCache::instance().prefetch(files);
+    for (const auto& file : files)
+        parse(file);
+}
+
+
+inline void OptionParser::parse_key_dir(const std::string& directory)
+{
+    std::vector<IniLine> lines;
+    std::vector<std::string> unknown_options;
+    load_key_dir(directory, lines, unknown_options);
+    key_dirs_.insert(directory);
+    apply_ini(directory, lines, unknown_options);
+}
+
+
+inline void OptionParser::load_key_dir(const std::string& directory, std::vector<IniLine>& lines, std::vector<std::string>& unknown_options) const
+{
+    std::vector<std::string> files = detail::list_key_files(directory);
+    std::vector<std::string> values(files.size());
+    std::vector<char> read(files.size(), 0);
+
+    std::atomic<size_t> next(0);
+    auto read_values = [&files, &values, &read, &next]() {
+        for (size_t n = next++; n < files.size(); n = next++)
+        {
+            if (!detail::read_file(files[n], values[n]))
+                continue;
+            read[n] = 1;
+            std::string& value = values[n];
+            while (!value.empty() && ((value.back() == '\n') || (value.back() == '\r')))
+                value.pop_back();
+        }
+    };
+    detail::run_workers(files.size(), read_values);
+
+    for (size_t n = 0; n < files.size(); ++n)
+    {
+        if (read[n] == 0)
+            throw std::runtime_error("failed to read file: " + files[n]);
+        std::string name = files[n].substr(directory.size() + 1);
+        Option_ptr option = find_option(name);
+        if (option && (option->attribute() != Attribute::inactive))
+            lines.push_back({option, detail::fnv1a(values[n].data(), values[n].size()), std::move(values[n])});
+        else
+            unknown_options.push_back(name);
+    }
+}
+
+
+inline void OptionParser::build_ini_index(const std::string& ini_filename, const std::string& index_filename)
+{
+    detail::FileStamp stamp;
+    std::ifstream file(ini_filename.c_str(), std::ios::in | std::ios::binary);
+    if (!detail::file_stamp(ini_filename, stamp) || !file)
+        throw std::runtime_error("failed to open ini file: " + ini_filename);
+
+    /// fixed size records of (key hash, line offset), sorted for binary search
+    std::vector<std::pair<uint64_t, uint64_t>> records;
+    detail::parse_ini(file, [&records](const std::string& section, const std::string& key, const std::string& /*value*/, size_t offset) {
+        std::string long_name = section.empty() ? key : section + "." + key;
+        records.emplace_back(detail::fnv1a(long_name.data(), long_name.size()), static_cast<uint64_t>(offset));
+    });
+    std::sort(records.begin(), records.end());
+
+    std::string index("POPLIDX1");
+    detail::put(index, stamp.size);
+    detail::put(index, stamp.mtime);
+    detail::put(index, stamp.inode);
+    detail::put(index, static_cast<uint64_t>(records.size()));
+    for (const auto& record : records)
+    {
+        detail::put(index, record.first);
+        detail::put(index, record.second);
+    }
+
+    std::ofstream out(index_filename.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    out.write(index.data(), static_cast<std::streamsize>(index.size()));
+    if (!out)
+        throw std::runtime_error("failed to write index file: " + index_filename);
+}
+
+
+inline void OptionParser::parse_indexed(const std::string& ini_filename, const std::string& index_filename)
+{
+    const size_t header_size = 8 + 4 * sizeof(uint64_t);
+    const size_t record_size = 2 * sizeof(uint64_t);
+    detail::FileStamp stamp;
+    detail::FileStamp indexed;
+    uint64_t count;
+    char header[header_size];
+    std::ifstream index(index_filename.c_str(), std::ios::in | std::ios::binary);
+    std::ifstream file(ini_filename.c_str(), std::ios::in | std::ios::binary);
+    const char* pos = header + 8;
+    const char* end = header + header_size;
+    if (!detail::file_stamp(ini_filename, stamp) || !file || !index.read(header, header_size) || (memcmp(header, "POPLIDX1", 8) != 0) ||
+        !detail::get(pos, end, indexed.size) || !detail::get(pos, end, indexed.mtime) || !detail::get(pos, end, indexed.inode) ||
+        !detail::get(pos, end, count) || !(indexed == stamp))
+    {
+        parse(ini_filename);
+        return;
+    }
+
+    auto read_record = [&index, header_size, record_size](uint64_t n, uint64_t& hash, uint64_t& offset) {
+        char record[record_size];
+        index.seekg(static_cast<std::streamoff>(header_size + n * record_size));
+        if (!index.read(record, record_size))
+            throw std::runtime_error("invalid index file");
+        const char* record_pos = record;
+        detail::get(record_pos, record + record_size, hash);
+        detail::get(record_pos, record + record_size, offset);
+    };
+
+    /// binary search for the first record with a hash
+    auto lower_bound = [&read_record, count](uint64_t key_hash) {
+        uint64_t hash;
+        uint64_t offset;
+        uint64_t first = 0;
+        uint64_t last = count;
+        while (first < last)
+        {
+            uint64_t mid = first + (last - first) / 2;
+            read_record(mid, hash, offset);
+            if (hash < key_hash)
+                first = mid + 1;
+            else
+                last = mid;
+        }
+        return first;
+    };
+
+    /// profile overlays replace lines of other sections
+    if (profile_option_)
+    {
+        parse(ini_filename);
+        return;
+    }
+
+    /// the keys of included files are not indexed
+    if (includes_)
+    {
+        for (const std::string directive : {"include", "include_dir"})
+        {
+            uint64_t key_hash = detail::fnv1a(directive.data(), directive.size());
+            uint64_t hash;
+            uint64_t offset;
+            uint64_t first = lower_bound(key_hash);
+            if ((first == count) || find_option(directive))
+                continue;
+            read_record(first, hash, offset);
+            if (hash == key_hash)
+            {
+                parse(ini_filename);
+                return;
+            }
+        }
+    }
+
+    std::vector<IniLine> lines;
+    for (const auto& option : options_)
+    {
+        if (option->long_name_.empty() || (option->attribute() == Attribute::inactive))
+            continue;
+
+        uint64_t key_hash = detail::fnv1a(option->long_name_.data(), option->long_name_.size());
+        uint64_t hash;
+        uint64_t offset;
+        uint64_t first = lower_bound(key_hash);
+        for (; first < count; ++first)
+        {
+            read_record(first, hash, offset);
+            if (hash != key_hash)
+                break;
+
+            std::string line;
+            file.clear();
+            file.seekg(static_cast<std::streamoff>(offset));
+            std::getline(file, line);
+            auto key_value = detail::split(detail::trim(line));
+            /// guard against hash collisions: the line's key must be the tail of the long name
+            const std::string& long_name = option->long_name_;
+            if (key_value.first.empty() || (key_value.first.size() > long_name.size()) ||
+                (long_name.compare(long_name.size() - key_value.first.size(), key_value.first.size(), key_value.first) != 0))
+                continue;
+            /// references need the whole file to be expanded
+            if (interpolation_ && (key_value.second.find("${") != std::string::npos))
+            {
+                parse(ini_filename);
+                return;
+            }
+            lines.push_back({option, detail::fnv1a(key_value.second.data(), key_value.second.size()), key_value.second});
+        }
+    }
+
+    apply_ini(ini_filename, lines, {});
+}
+
+
+inline void OptionParser::apply_ini(const std::string& ini_filename, const std::vector<IniLine>& lines, const std::vector<std::string>& unknown_options,
+                                    const std::vector<std::string>& files)
+{
+    for (const auto& file : files)
+        if (file != ini_filename)
+            included_files_.insert(file);
+
+    size_t idx = static_cast<size_t>(std::find(ini_files_.begin(), ini_files_.end(), ini_filename) - ini_files_.begin());
+    if (idx == ini_files_.size())
+    {
+        ini_files_.push_back(ini_filename);
+        ini_lines_.emplace_back();
+    }
+
+    auto& file_lines = ini_lines_[idx];
+    file_lines.insert(file_lines.end(), lines.begin(), lines.end());
+    unknown_options_.insert(unknown_options_.end(), unknown_options.begin(), unknown_options.end());
+    for (const auto& line : lines)
+    {
+        size_t position = line.option->count();
+        line.option->parse(OptionName::long_name, line.value.c_str());
+        ini_positions_[line.option.get()].push_back(position);
+        sources_[line.option.get()] = ini_filename;
+    }
+}
+
+
+inline void OptionParser::apply_lines(const std::vector<IniLine>& lines, const std::vector<std::string>& unknown_options)
+{
+    unknown_options_.insert(unknown_options_.end(), unknown_options.begin(), unknown_options.end());
+    for (const auto& line : lines)
+    {
+        line.option->parse(OptionName::long_name, line.value.c_str());
+        sources_[line.option.get()] = "ini data";
+    }
+}
+
+
+inline void OptionParser::write_lines(std::string& buffer, const std::vector<IniLine>& lines) const
+{
+    detail::put(buffer, static_cast<uint32_t>(lines.size()));
+    for (const auto& line : lines)
+    {
+        detail::put(buffer, line.option->long_name_);
+        detail::put(buffer, line.value);
+    }
+}
+
+
+inline bool OptionParser::read_lines(const char*& pos, const char* end, std::vector<IniLine>& lines) const
+{
+    uint32_t count;
+    if (!detail::get(pos, end, count))
+        return false;
+    for (uint32_t n = 0; n < count; ++n)
+    {
+        std::string key;
+        IniLine line;
+        if (!detail::get(pos, end, key) || !detail::get(pos, end, line.value))
+            return false;
+        line.option = find_option(key);
+        if (!line.option)
+            return false;
+        line.hash = detail::fnv1a(line.value.data(), line.value.size());
+        lines.push_back(std::move(line));
+    }
+    return true;
+}
+
+
+inline std::string OptionParser::snapshot() const
+{
+    std::string buffer("POPLSNP1");
+    detail::put(buffer, schema_hash());
+    detail::put(buffer, unknown_options_);
+    detail::put(buffer, static_cast<uint32_t>(ini_files_.size()));
+    for (size_t n = 0; n < ini_files_.size(); ++n)
+    {
+        detail::put(buffer, ini_files_[n]);
+        write_lines(buffer, ini_lines_[n]);
+    }
+    return buffer;
+}
+
+
+inline void OptionParser::parse_snapshot(const char* data, size_t size)
+{
+    const char* pos = data;
+    const char* end = data + size;
+    uint64_t schema;
+    std::vector<std::string> unknown_options;
+    uint32_t count;
+    if ((size < 8) || (memcmp(data, "POPLSNP1", 8) != 0))
+        throw std::invalid_argument("invalid snapshot");
+    pos += 8;
+    if (!detail::get(pos, end, schema) || !detail::get(pos, end, unknown_options) || !detail::get(pos, end, count))
+        throw std::invalid_argument("invalid snapshot");
+    if (schema != schema_hash())
+        throw std::invalid_argument("snapshot does not match the added options");
+
+    for (uint32_t n = 0; n < count; ++n)
+    {
+        std::string ini_filename;
+        std::vector<IniLine> lines;
+        if (!detail::get(pos, end, ini_filename) || !read_lines(pos, end, lines))
+            throw std::invalid_argument("invalid snapshot");
+        apply_ini(ini_filename, lines, {});
+    }
+    unknown_options_.insert(unknown_options_.end(), unknown_options.begin(), unknown_options.end());
+}
+
+
+#ifdef MFD_ALLOW_SEALING
+inline int OptionParser::snapshot_fd() const
+{
+    std::string buffer = snapshot();
+    int fd = memfd_create("popl_snapshot", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0)
+        throw std::runtime_error(std::string("memfd_create failed: ") + strerror(errno));
+
+    size_t written = 0;
+    while (written < buffer.size())
+    {
+        ssize_t ret = write(fd, buffer.data() + written, buffer.size() - written);
+        if ((ret < 0) && (errno == EINTR))
+            continue;
+        if (ret <= 0)
+            break;
+        written += static_cast<size_t>(ret);
+    }
+    if ((written != buffer.size()) || (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) != 0))
+    {
+        std::string error = strerror(errno);
+        close(fd);
+        throw std::runtime_error("failed to create snapshot memfd: " + error);
+    }
+    return fd;
+}
+
+
+inline void OptionParser::parse_snapshot(int fd)
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+        throw std::runtime_error(std::string("fstat failed: ") + strerror(errno));
+    auto size = static_cast<size_t>(st.st_size);
+    void* data = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED)
+        throw std::runtime_error(std::string("mmap failed: ") + strerror(errno));
+    try
+    {
+        parse_snapshot(static_cast<const char*>(data), size);
+    }
+    catch (...)
+    {
+        munmap(data, size);
+        throw;
+    }
+    munmap(data, size);
+}
+#endif
+
+
+inline uint64_t OptionParser::schema_hash() const
+{
+    uint64_t hash = detail::fnv1a(nullptr, 0);
+    for (const auto& option : options_)
+    {
+        if (option->attribute() == Attribute::inactive)
+            continue;
+        const std::string& long_name = option->long_name_;
+        hash = detail::fnv1a(long_name.c_str(), long_name.size() + 1, hash);
+    }
+    return hash;
+}
+
+
+inline std::string OptionParser::select_profile(const std::vector<std::vector<IniLine>>& previous, const std::vector<IniLine>& lines) const
+{
+    /// A profile set on the command line (or by any other source than ini files) wins over the ini files
+    auto iter = ini_positions_.find(profile_option_.get());
+    for (size_t n = 0; n < profile_option_->count(); ++n)
+        if ((iter == ini_positions_.end()) || (std::find(iter->second.begin(), iter->second.end(), n) == iter->second.end()))
+            return profile_option_->value(n);
+
+    std::string profile = profile_option_->has_default() ? profile_option_->get_default() : "";
+    for (const auto& file_lines : previous)
+        for (const auto& line : file_lines)
+            if (line.option == profile_option_)
+                profile = line.value;
+    for (const auto& line : lines)
+        if (line.option == profile_option_)
+            profile = line.value;
+    return profile;
+}
+
+
+inline std::set<std::string> OptionParser::section_prefixes() const
+{
+    std::set<std::string> prefixes;
+    for (const auto& option : options_)
+    {
+        if (option->attribute() == Attribute::inactive)
+            continue;
+        for (size_t pos = option->long_name_.find('.'); pos != std::string::npos; pos = option->long_name_.find('.', pos + 1))
+            prefixes.insert(option->long_name_.substr(0, pos));
+    }
+    return prefixes;
+}
+
+
+inline bool OptionParser::parse_ini(const std::string& ini_filename, std::vector<IniLine>& lines, std::vector<std::string>& unknown_options,
+                                    const std::shared_ptr<const detail::IniDocument>& document, std::vector<std::string>* files,
+                                    const std::vector<std::vector<IniLine>>* previous) const
+{
+    IniLoad load{long_name_index(), section_prefixes(), {}, {}, {}, {}, {}, lines, unknown_options};
+    if (document)
+        load_document(ini_filename, document, load);
+    else
+        load_ini(ini_filename, load);
+    if (files != nullptr)
+        files->swap(load.files);
+
+    /// Replace the lines of Options that are overridden by the selected profile
+    std::string profile;
+    if (profile_option_)
+        profile = select_profile(previous != nullptr ? *previous : ini_lines_, lines);
+    if (!load.overlays.empty())
+    {
+        std::set<const Option*> overridden;
+        for (const auto& overlay : load.overlays)
+            if (overlay.first == profile)
+                overridden.insert(overlay.second.option.get());
+        lines.erase(std::remove_if(lines.begin(), lines.end(), [&overridden](const IniLine& line) { return overridden.count(line.option.get()) > 0; }),
+                    lines.end());
+        for (const auto& overlay : load.overlays)
+            if (overlay.first == profile)
+                lines.push_back(overlay.second);
+    }
+
+    /// Expand references only in values of added Options, and only if there are any
+    std::unique_ptr<detail::IniInterpolator> interpolator;
+    for (auto& line : lines)
+    {
+        if (!interpolation_ || (line.value.find("${") == std::string::npos))
+            continue;
+        if (!interpolator)
+            interpolator.reset(new detail::IniInterpolator(load.documents, profile));
+        try
+        {
+            line.value = interpolator->expand(line.value);
+        }
+        catch (const std::invalid_argument& e)
+        {
+            throw invalid_option(line.option.get(), invalid_option::Error::invalid_argument, OptionName::long_name, line.value,
+                                 "invalid argument for " + line.option->name(OptionName::long_name, true) + ": " + e.what());
+        }
+        line.hash = detail::fnv1a(line.value.data(), line.value.size());
+    }
+    return !interpolator || !interpolator->environment();
+}
+
+
+inline void OptionParser::load_ini(const std::string& ini_filename, IniLoad& load) const
+{
+    const size_t max_include_depth = 16;
+    if (std::find(load.stack.begin(), load.stack.end(), ini_filename) != load.stack.end())
+        throw std::runtime_error("include cycle: \"" + ini_filename + "\" includes itself");
+    if (load.stack.size() > max_include_depth)
+        throw std::runtime_error("include depth exceeds " + std::to_string(max_include_depth) + ": \"" + ini_filename + "\"");
+    if (!load.loaded.insert(ini_filename).second)
+        return;
+    load.files.push_back(ini_filename);
+
+    auto document = detail::IniCache::instance().get(ini_filename);
+    if (!document)
+    {
+        if (load.stack.empty())
+            return;
+        throw std::runtime_error("failed to include \"" + ini_filename + "\" from \"" + load.stack.back() + "\"");
+    }
+    load_document(ini_filename, document, load);
+}
+
+
+inline void OptionParser::load_include(const std::string& ini_filename, const std::string& key, const std::string& value, IniLoad& load) const
+{
+    if (key == "include")
+    {
+        load_ini(detail::resolve_path(ini_filename, value), load);
+        return;
+    }
+
+    std::string directory = detail::resolve_path(ini_filename, value);
+    load.files.push_back(directory);
+    std::vector<std::string> files = detail::list_files(directory, ".conf");
+    std::sort(files.begin(), files.end());
+    detail::IniCache::instance().prefetch(files);
+    for (const auto& file : files)
+        load_ini(file, load);
+}
+
+
+inline void OptionParser::load_document(const std::string& ini_filename, const std::shared_ptr<const detail::IniDocument>& document, IniLoad& load) const
+{
+    load.stack.push_back(ini_filename);
+    load.documents.push_back(document);
+    for (const auto& section : document->sections)
+    {
+        /// "[profile.NAME.section]" is an overlay for "[section]"
+        std::string profile;
+        std::string name = section.name;
+        if (profile_option_ && (name.compare(0, 8, "profile.") == 0))
+        {
+            size_t pos = name.find('.', 8);
+            profile = name.substr(8, pos == std::string::npos ? std::string::npos : pos - 8);
+            name = (pos == std::string::npos) ? "" : name.substr(pos + 1);
+        }
+
+        /// Sections without added Options are skipped as a whole, their keys are reported only on request
+        if (!name.empty() && (load.prefixes.find(name) == load.prefixes.end()))
+        {
+            if (report_unknown_sections_)
+                for (size_t n = section.begin; n < section.end; ++n)
+                    load.unknown_options.push_back(section.name + "." + document->entries[n].first);
+            continue;
+        }
+
+        for (size_t n = section.begin; n < section.end; ++n)
+        {
+            const auto& entry = document->entries[n];
+            Option_ptr option = find_option(load.index, name, entry.first);
+            if (option && !profile.empty())
+            {
+                load.overlays.emplace_back(profile, IniLine{option, detail::fnv1a(entry.second.data(), entry.second.size()), entry.second});
+            }
+            else if (option)
+            {
+                load.lines.push_back({option, detail::fnv1a(entry.second.data(), entry.second.size()), entry.second});
+            }
+            else if (includes_ && section.name.empty() && ((entry.first == "include") || (entry.first == "include_dir")))
+            {
+                load_include(ini_filename, entry.first, entry.second, load);
+            }
+            else
+                load.unknown_options.push_back(section.name.empty() ? entry.first : section.name + "." + entry.first);
+        }
+    }
+    load.stack.pop_back();
+}
+
+
+inline void OptionParser::parse(int argc, const char* const argv[])
+{
+    if (response_files_ && (argc > 0))
+    {
+        /// the expanded arguments point into the buffers, that must live until parsing is done
+        std::vector<std::unique_ptr<detail::ArgBuffer>> buffers;
+        std::vector<std::string> stack;
+        std::vector<const char*> args;
+        ArgState state;
+        args.reserve(static_cast<size_t>(argc));
+        expand_response_files(argv, argv + argc, args, buffers, stack, state);
+        parse_args(static_cast<int>(args.size()), args.data());
+    }
+    else
+        parse_args(argc, argv);
+}
+
+
+inline ParseEvents OptionParser::events(int argc, const char* const argv[]) const
+{
+    return ParseEvents(this, argc, argv);
+}
+
+
+#ifdef POPL_COROUTINES
+inline Generator<ParseEvent> OptionParser::generate_events(int argc, const char* const argv[]) const
+{
+    ParseEvents events(this, argc, argv);
+    for (const auto& event : events)
+        co_yield event;
+}
+#endif
+
+
+inline void OptionParser::parse_command_line(const std::string& command_line)
+{
+    parse_command_line(command_line.data(), command_line.size());
+}
+
+
+inline void OptionParser::parse_command_line(const char* data, size_t size)
+{
+    /// one copy of the string that is split in place, the arguments point into it
+    detail::ArgBuffer buffer;
+    buffer.assign(data, size);
+    std::vector<const char*> args(1, "");
+    detail::split_args(buffer.data(), buffer.size(), args);
+    parse(static_cast<int>(args.size()), args.data());
+}
+
+
+#ifdef __linux__
+inline void OptionParser::parse_proc_cmdline()
+{
+    const auto& args = detail::ProcCmdline::instance().args();
+    parse(static_cast<int>(args.size()), args.data());
+}
+#endif
+
+
+inline void OptionParser::set_response_files(bool enable)
+{
+    response_files_ = enable;
+}
+
+
+inline void OptionParser::expand_response_files(const char* const* begin, const char* const* end, std::vector<const char*>& args,
+                                                std::vector<std::unique_ptr<detail::ArgBuffer>>& buffers, std::vector<std::string>& stack,
+                                                ArgState& state) const
+{
+    ArgTracker tracker;
+    for (const char* const* arg = begin; arg != end; ++arg)
+    {
+        /// the program name of argv[0] is never expanded
+        if (args.empty())
+        {
+            args.push_back(*arg);
+            continue;
+        }
+
+        /// the argument of an option is never expanded, e.g. "--mention @bob"
+        if (((*arg)[0] != '@') || ((*arg)[1] == 0) || state.pending)
+        {
+            args.push_back(*arg);
+            /// "--" ends the options, unless it is the argument of an option
+            split_arg(*arg, state, tracker);
+            if (state.end_of_options)
+            {
+                args.insert(args.end(), arg + 1, end);
+                return;
+            }
+            continue;
+        }
+
+        std::string filename(*arg + 1);
+        if (std::find(stack.begin(), stack.end(), detail::canonical_path(filename)) != stack.end())
+            throw std::runtime_error("response file cycle: \"" + filename + "\" includes itself");
+        buffers.emplace_back(new detail::ArgBuffer);
+        detail::ArgBuffer& buffer = *buffers.back();
+        if (!buffer.load(filename))
+            throw std::runtime_error("failed to open response file: " + filename);
+
+        std::vector<const char*> file_args;
+        detail::split_args(buffer.data(), buffer.size(), file_args);
+        stack.push_back(detail::canonical_path(filename));
+        expand_response_files(file_args.data(), file_args.data() + file_args.size(), args, buffers, stack, state);
+        stack.pop_back();
+        /// "--" in a response file ends the expansion of the whole command line
+        if (state.end_of_options)
+        {
+            args.insert(args.end(), arg + 1, end);
+            return;
+        }
+    }
+}
+
+
+inline void OptionParser::parse_args(int argc, const char* const argv[])
+{
+    ArgState state;
+    ArgApplier applier{*this};
+    for (int n = 1; n < argc; ++n)
+        split_arg(argv[n], state, applier);
+    finish_args(state, applier);
+    check_required();
+}
+
+
+template <typename Handler>
+inline void OptionParser::split_arg(const char* argument, ArgState& state, Handler& handler) const
+{
+    if (state.pending)
+    {
+        /// the argument of the previous option
+        Option_ptr option;
+        option.swap(state.pending);
+        handler.option(option, state.pending_name, argument);
+        return;
+    }
+
+    const std::string arg(argument);
+    if (state.end_of_options)
+    {
+        handler.non_option(arg);
+    }
+    else if (arg == "--")
+    {
+        /// from here on only non opt args
+        state.end_of_options = true;
+        handler.end_of_options();
+    }
+    else if (arg.find("--") == 0)
+    {
+        /// long option arg
+        std::string opt = arg.substr(2);
+        std::string optarg;
+        size_t equalIdx = opt.find('=');
+        if (equalIdx != std::string::npos)
+        {
+            optarg = opt.substr(equalIdx + 1);
+            opt.resize(equalIdx);
+        }
+
+        Option_ptr option = find_option(opt);
+        if (option && (option->attribute() == Attribute::inactive))
+            option = nullptr;
+        if (option)
+        {
+            if (option->argument_type() == Argument::no)
+            {
+                if (!optarg.empty())
+                    option = nullptr;
+            }
+            else if ((option->argument_type() == Argument::required) && optarg.empty())
+            {
+                /// the optarg is the next arg
+                state.pending = option;
+                state.pending_name = OptionName::long_name;
+                return;
+            }
+        }
+
+        if (option)
+            handler.option(option, OptionName::long_name, optarg);
+        else
+            handler.unknown(arg);
+    }
+    else if (arg.find('-') == 0)
+    {
+        /// short option arg
+        std::string opt = arg.substr(1);
+        bool unknown = false;
+        for (size_t m = 0; m < opt.size(); ++m)
+        {
+            char c = opt[m];
+            std::string optarg;
+
+            Option_ptr option = find_option(c);
+            if (option && (option->attribute() == Attribute::inactive))
+                option = nullptr;
+            if (option)
+            {
+                if (option->argument_type() == Argument::required)
+                {
+                    /// use the rest of the current argument as optarg
+                    optarg = opt.substr(m + 1);
+                    m = opt.size();
+                    /// or the next arg
+                    if (optarg.empty())
+                    {
+                        state.pending = option;
+                        state.pending_name = OptionName::short_name;
+                        continue;
+                    }
+                }
+                else if (option->argument_type() == Argument::optional)
+                {
+                    /// use the rest of the current argument as optarg
+                    optarg = opt.substr(m + 1);
+                    m = opt.size();
+                }
+            }
+
+            if (option)
+                handler.option(option, OptionName::short_name, optarg);
+            else
+                unknown = true;
+        }
+        if (unknown)
+            handler.unknown(arg);
+    }
+    else
+    {
+        handler.non_option(arg);
+    }
+}
+
+
+template <typename Handler>
+inline void OptionParser::finish_args(ArgState& state, Handler& handler) const
 {
-    return values_.size();
+    /// a missing optarg is passed as empty argument
+    if (state.pending)
+    {
+        Option_ptr option;
+        option.swap(state.pending);
+        handler.option(option, state.pending_name, "");
+    }
+    state.end_of_options = false;
 }
 
 
-template <class T>
-inline bool Value<T>::is_set() const
+inline void OptionParser::check_required() const
 {
-    return !values_.empty();
+    for (auto& opt : options_)
+    {
+        if ((opt->attribute() == Attribute::required) && !opt->is_set())
+        {
+            std::string option = opt->long_name().empty() ? std::string(1, opt->short_name()) : opt->long_name();
+            throw invalid_option(opt.get(), invalid_option::Error::missing_option, "option \"" + option + "\" is required");
+        }
+    }
 }
 
 
-template <class T>
-inline void Value<T>::assign_to(T* var)
+inline void OptionParser::reload()
 {
-    assign_to_ = var;
-    update_reference();
+    std::vector<std::vector<IniLine>> ini_lines(ini_files_.size());
+    std::vector<std::string> unknown_options;
+    std::set<std::string> included_files;
+    std::vector<std::string> loaded_files;
+    for (size_t n = 0; n < ini_files_.size(); ++n)
+    {
+        if (is_key_dir(ini_files_[n]))
+            load_key_dir(ini_files_[n], ini_lines[n], unknown_options);
+        else
+            parse_ini(ini_files_[n], ini_lines[n], unknown_options, nullptr, &loaded_files, &ini_lines);
+        for (const auto& file : loaded_files)
+            if (file != ini_files_[n])
+                included_files.insert(file);
+        loaded_files.clear();
+    }
+
+    /// Compare the per Option sequences of line fingerprints, in order of parsing
+    auto fingerprints = [](const std::vector<std::vector<IniLine>>& files) {
+        std::map<const Option*, std::vector<uint64_t>> result;
+        for (const auto& lines : files)
+            for (const auto& line : lines)
+                result[line.option.get()].push_back(line.hash);
+        return result;
+    };
+    auto old_fingerprints = fingerprints(ini_lines_);
+    auto new_fingerprints = fingerprints(ini_lines);
+
+    std::set<const Option*> changed;
+    for (const auto& fingerprint : old_fingerprints)
+        if (new_fingerprints.find(fingerprint.first) == new_fingerprints.end())
+            changed.insert(fingerprint.first);
+    for (const auto& fingerprint : new_fingerprints)
+    {
+        auto iter = old_fingerprints.find(fingerprint.first);
+        if ((iter == old_fingerprints.end()) || (iter->second != fingerprint.second))
+            changed.insert(fingerprint.first);
+    }
+
+    /// Convert the new values into copies of the changed Options first, so that an invalid value leaves all Options untouched
+    std::map<const Option*, Option_ptr> copies;
+    for (const auto& opt : options_)
+    {
+        if (changed.find(opt.get()) == changed.end())
+            continue;
+        Option_ptr copy = opt->clone();
+        if (!copy)
+            continue;
+        copy->clear();
+        copies[opt.get()] = copy;
+    }
+    for (const auto& lines : ini_lines)
+        for (const auto& line : lines)
+        {
+            auto iter = copies.find(line.option.get());
+            if (iter != copies.end())
+                iter->second->parse(OptionName::long_name, line.value.c_str());
+        }
+
+    included_files_.swap(included_files);
+    for (const auto& unknown_option : unknown_options)
+        if (std::find(unknown_options_.begin(), unknown_options_.end(), unknown_option) == unknown_options_.end())
+            unknown_options_.push_back(unknown_option);
+    ini_lines_.swap(ini_lines);
+
+    /// Replace only the values that have been parsed from ini files, values of other sources are kept
+    std::set<const Option*> reparse;
+    for (const auto& opt : options_)
+    {
+        if (changed.find(opt.get()) == changed.end())
+            continue;
+        auto& positions = ini_positions_[opt.get()];
+        std::sort(positions.begin(), positions.end());
+        size_t insert_at = positions.empty() ? opt->count() : std::min(positions.front(), opt->count());
+        auto iter = copies.find(opt.get());
+        bool replaced = (iter != copies.end()) && opt->replace_values(positions, *iter->second);
+        positions.clear();
+        if (replaced)
+        {
+            for (size_t n = 0; n < iter->second->count(); ++n)
+                positions.push_back(insert_at + n);
+        }
+        else
+        {
+            /// Options that cannot be copied lose the values of other sources
+            opt->clear();
+            reparse.insert(opt.get());
+        }
+    }
+
+    for (size_t idx = 0; idx < ini_lines_.size(); ++idx)
+        for (const auto& line : ini_lines_[idx])
+            if (reparse.find(line.option.get()) != reparse.end())
+            {
+                size_t position = line.option->count();
+                line.option->parse(OptionName::long_name, line.value.c_str());
+                ini_positions_[line.option.get()].push_back(position);
+                sources_[line.option.get()] = ini_files_[idx];
+            }
 }
 
 
-template <class T>
-inline void Value<T>::set_value(const T& value)
+inline void OptionParser::reset()
 {
-    clear();
-    add_value(value);
+    for (auto& lines : ini_lines_)
+        lines.clear();
+    ini_positions_.clear();
+    sources_.clear();
+    unknown_options_.clear();
+    non_option_args_.clear();
+    for (auto& opt : options_)
+        opt->clear();
 }
 
-template <class T>
-inline T Value<T>::value_or(const T& default_value, size_t idx) const
+
+inline void OptionParser::set_interpolation(bool enable)
 {
-    if (idx < values_.size())
-        return values_[idx];
-    else if (default_)
-        return *default_;
+    interpolation_ = enable;
+}
+
+
+inline void OptionParser::set_includes(bool enable)
+{
+    includes_ = enable;
+}
+
+
+inline void OptionParser::set_report_unknown_sections(bool enable)
+{
+    report_unknown_sections_ = enable;
+}
+
+
+inline void OptionParser::set_profile_option(const std::string& long_name)
+{
+    profile_option_ = get_option<Value<std::string>>(long_name);
+}
+
+
+inline void OptionParser::clear_ini_cache()
+{
+    detail::IniCache::instance().clear();
+}
+
+
+inline std::string OptionParser::help(const Attribute& max_attribute) const
+{
+    ConsoleOptionPrinter option_printer(this);
+    return option_printer.print(max_attribute);
+}
+
+
+
+/// ConsoleOptionPrinter implementation /////////////////////////////////
+
+inline ConsoleOptionPrinter::ConsoleOptionPrinter(const OptionParser* option_parser) : OptionPrinter(option_parser)
+{
+}
+
+
+inline std::string ConsoleOptionPrinter::to_string(Option_ptr option) const
+{
+    std::stringstream line;
+    if (option->short_name() != 0)
+    {
+        line << "  -" << option->short_name();
+        if (!option->long_name().empty())
+            line << ", ";
+    }
     else
-        return default_value;
+        line << "  ";
+    if (!option->long_name().empty())
+        line << "--" << option->long_name();
+
+    if (option->argument_type() == Argument::required)
+    {
+        line << " arg";
+        std::stringstream defaultStr;
+        if (option->get_default(defaultStr))
+        {
+            if (!defaultStr.str().empty())
+                line << " (=" << defaultStr.str() << ")";
+        }
+    }
+    else if (option->argument_type() == Argument::optional)
+    {
+        std::stringstream defaultStr;
+        if (option->get_default(defaultStr))
+            line << " [=arg(=" << defaultStr.str() << ")]";
+    }
+
+    return line.str();
 }
 
-template <class T>
-inline T Value<T>::value(size_t idx) const
+
+inline std::string ConsoleOptionPrinter::print(const Attribute& max_attribute) const
 {
-    if (!this->is_set() && default_)
-        return *default_;
+    if (option_parser_ == nullptr)
+        return "";
 
-    if (!is_set() || (idx >= count()))
+    if (max_attribute < Attribute::optional)
+        throw std::invalid_argument("attribute must be 'optional', 'advanced', or 'default'");
+
+    std::stringstream s;
+    if (!option_parser_->description().empty())
+        s << option_parser_->description() << ":\n";
+
+    size_t optionRightMargin(20);
+    const size_t maxDescriptionLeftMargin(40);
+    //	const size_t descriptionRightMargin(80);
+
+    for (const auto& option : option_parser_->options())
+        optionRightMargin = std::max(optionRightMargin, to_string(option).size() + 2);
+    optionRightMargin = std::min(maxDescriptionLeftMargin - 2, optionRightMargin);
+
+    for (const auto& option : option_parser_->options())
     {
-        std::stringstream optionStr;
-        if (!is_set())
-            optionStr << "option not set: \"";
+        if ((option->attribute() <= Attribute::hidden) || (option->attribute() > max_attribute))
+            continue;
+        std::string optionStr = to_string(option);
+        if (optionStr.size() < optionRightMargin)
+            optionStr.resize(optionRightMargin, ' ');
         else
-            optionStr << "index out of range (" << idx << ") for \"";
+            optionStr += "\n" + std::string(optionRightMargin, ' ');
+        s << optionStr;
 
-        if (short_name() != 0)
-            optionStr << "-" << short_name();
-        else
-            optionStr << "--" << long_name();
+        std::string line;
+        std::vector<std::string> lines;
+        std::stringstream description(option->description());
+        while (std::getline(description, line, '\n'))
+            lines.push_back(line);
 
-        optionStr << "\"";
-        throw std::out_of_range(optionStr.str());
+        std::string empty(optionRightMargin, ' ');
+        for (size_t n = 0; n < lines.size(); ++n)
+        {
+            if (n > 0)
+                s << "\n" << empty;
+            s << lines[n];
+        }
+        s << "\n";
     }
 
-    return values_[idx];
+    return s.str();
 }
 
 
 
-template <class T>
-inline void Value<T>::set_default(const T& value)
+/// GroffOptionPrinter implementation /////////////////////////////////
+
+inline GroffOptionPrinter::GroffOptionPrinter(const OptionParser* option_parser) : OptionPrinter(option_parser)
 {
-    this->default_.reset(new T);
-    *this->default_ = value;
-    update_reference();
 }
 
 
-template <class T>
-inline bool Value<T>::has_default() const
+inline std::string GroffOptionPrinter::to_string(Option_ptr option) const
 {
-    return (this->default_ != nullptr);
+    std::stringstream line;
+    if (option->short_name() != 0)
+    {
+        line << "-" << option->short_name();
+        if (!option->long_name().empty())
+            line << ", ";
+    }
+    if (!option->long_name().empty())
+        line << "--" << option->long_name();
+
+    if (option->argument_type() == Argument::required)
+    {
+        line << " arg";
+        std::stringstream defaultStr;
+        if (option->get_default(defaultStr))
+        {
+            if (!defaultStr.str().empty())
+                line << " (=" << defaultStr.str() << ")";
+        }
+    }
+    else if (option->argument_type() == Argument::optional)
+    {
+        std::stringstream defaultStr;
+        if (option->get_default(defaultStr))
+            line << " [=arg(=" << defaultStr.str() << ")]";
+    }
+
+    return line.str();
+}
+
+
+inline std::string GroffOptionPrinter::print(const Attribute& max_attribute) const
+{
+    if (option_parser_ == nullptr)
+        return "";
+
+    if (max_attribute < Attribute::optional)
+        throw std::invalid_argument("attribute must be 'optional', 'advanced', or 'default'");
+
+    std::stringstream s;
+    if (!option_parser_->description().empty())
+        s << ".SS " << option_parser_->description() << ":\n";
+
+    for (const auto& option : option_parser_->options())
+    {
+        if ((option->attribute() <= Attribute::hidden) || (option->attribute() > max_attribute))
+            continue;
+        s << ".TP\n\\fB" << to_string(option) << "\\fR\n";
+        if (!option->description().empty())
+            s << option->description() << "\n";
+    }
+
+    return s.str();
 }
 
 
-template <class T>
-inline T Value<T>::get_default() const
-{
-    if (!has_default())
-        throw std::runtime_error("no default value set");
-    return *this->default_;
-}
 
+/// BashCompletionOptionPrinter implementation /////////////////////////////////
 
-template <class T>
-inline bool Value<T>::get_default(std::ostream& out) const
+inline BashCompletionOptionPrinter::BashCompletionOptionPrinter(const OptionParser* option_parser, std::string program_name)
+    : OptionPrinter(option_parser), program_name_(std::move(program_name))
 {
-    if (!has_default())
-        return false;
-    out << *this->default_;
-    return true;
 }
 
 
-template <class T>
-inline Argument Value<T>::argument_type() const
+inline std::string BashCompletionOptionPrinter::print(const Attribute& /*max_attribute*/) const
 {
-    return Argument::required;
-}
+    if (option_parser_ == nullptr)
+        return "";
 
+    std::stringstream s;
+    s << "_" << program_name_ << "()\n";
+    s << R"({
+	local cur prev opts
+	COMPREPLY=()
+	cur="${COMP_WORDS[COMP_CWORD]}"
+	prev="${COMP_WORDS[COMP_CWORD-1]}"
+	opts=")";
 
-template <>
-inline void Value<std::string>::parse(OptionName what_name, const char* value)
-{
-    if (strlen(value) == 0)
-        throw invalid_option(this, invalid_option::Error::missing_argument, what_name, value, "missing argument for " + name(what_name, true));
+    for (const auto& option : option_parser_->options())
+    {
+        if (option->attribute() > Attribute::hidden)
+        {
+            if (option->short_name() != 0)
+                s << "-" << option->short_name() << " ";
+            if (!option->long_name().empty())
+                s << "--" << option->long_name() << " ";
+        }
+    }
 
-    add_value(value);
+    s << R"("
+	if [[ ${cur} == -* ]] ; then
+		COMPREPLY=( $(compgen -W "${opts}" -- ${cur}) )
+		return 0
+	fi
+}
+complete -F )";
+    s << "_" << program_name_ << " " << program_name_ << "\n";
+
+    return s.str();
 }
 
 
-template <>
-inline void Value<bool>::parse(OptionName /*what_name*/, const char* value)
+
+/// IniWriter implementation /////////////////////////////////
+
+inline IniWriter::IniWriter(const OptionParser* option_parser) : option_parser_(option_parser)
 {
-    bool val =
-        ((value != nullptr) && ((strcmp(value, "1") == 0) || (strcmp(value, "true") == 0) || (strcmp(value, "True") == 0) || (strcmp(value, "TRUE") == 0)));
-    add_value(val);
 }
 
 
-template <class T>
-inline void Value<T>::parse(OptionName what_name, const char* value)
+inline bool IniWriter::write(std::ostream& out, const Option_ptr& option, const std::string& key, bool non_default_only) const
 {
-    T parsed_value;
-    std::string strValue;
-    if (value != nullptr)
-        strValue = value;
+    std::stringstream value;
+    value << std::boolalpha;
+    if (!option->is_set())
+    {
+        /// the default of a Switch or the implicit value of an Implicit would set the Option when read back
+        if (non_default_only || (option->argument_type() != Argument::required) || !option->get_default(value) || value.str().empty())
+            return false;
+        out << key << " = " << value.str() << "\n";
+        return true;
+    }
 
-    std::istringstream is(strValue);
-    int valuesRead = 0;
-    while (is.good())
+    if (non_default_only && (option->count() == 1))
     {
-        if (is.peek() != EOF)
-            is >> parsed_value;
-        else
-            break;
+        std::stringstream default_value;
+        default_value << std::boolalpha;
+        option->get_value(value, 0);
+        if (option->get_default(default_value) && (value.str() == default_value.str()))
+            return false;
+        value.str("");
+    }
 
-        valuesRead++;
+    /// empty values cannot be read back ("key =" is a missing argument)
+    bool written = false;
+    for (size_t n = 0; option->get_value(value, n); ++n)
+    {
+        if (!value.str().empty())
+        {
+            out << key << " = " << value.str() << "\n";
+            written = true;
+        }
+        value.str("");
     }
+    return written;
+}
 
-    if (is.fail())
-        throw invalid_option(this, invalid_option::Error::invalid_argument, what_name, value,
-                             "invalid argument for " + name(what_name, true) + ": '" + strValue + "'");
 
-    if (valuesRead > 1)
-        throw invalid_option(this, invalid_option::Error::too_many_arguments, what_name, value,
-                             "too many arguments for " + name(what_name, true) + ": '" + strValue + "'");
+inline void IniWriter::write(std::ostream& out, bool non_default_only) const
+{
+    if (option_parser_ == nullptr)
+        return;
 
-    if (strValue.empty())
-        throw invalid_option(this, invalid_option::Error::missing_argument, what_name, "", "missing argument for " + name(what_name, true));
+    /// keys without section first, then the sections in order of their first Option
+    std::vector<std::string> sections(1);
+    for (const auto& option : option_parser_->options())
+    {
+        size_t pos = option->long_name().rfind('.');
+        std::string section = (pos == std::string::npos) ? "" : option->long_name().substr(0, pos);
+        if (std::find(sections.begin(), sections.end(), section) == sections.end())
+            sections.push_back(section);
+    }
 
-    this->add_value(parsed_value);
+    bool empty = true;
+    for (const auto& section : sections)
+    {
+        bool header = section.empty();
+        for (const auto& option : option_parser_->options())
+        {
+            std::string long_name = option->long_name();
+            if (long_name.empty() || (option->attribute() == Attribute::inactive))
+                continue;
+            size_t pos = long_name.rfind('.');
+            if (section.empty() ? (pos != std::string::npos) : ((pos != section.size()) || (long_name.compare(0, pos, section) != 0)))
+                continue;
+
+            std::stringstream lines;
+            if (write(lines, option, long_name.substr(section.empty() ? 0 : pos + 1), non_default_only))
+            {
+                if (!header)
+                    out << (empty ? "" : "\n") << "[" << section << "]\n";
+                header = true;
+                empty = false;
+                out << lines.str();
+            }
+        }
+    }
+    out.flush();
 }
 
 
-template <class T>
-inline void Value<T>::update_reference()
+#ifdef __linux__
+inline void IniWriter::write(int fd, bool non_default_only) const
 {
-    if (this->assign_to_)
+    /// ostream on top of a small fixed buffer that is flushed to fd
+    class FdStreamBuf : public std::streambuf
     {
-        if (!this->is_set() && default_)
-            *this->assign_to_ = *default_;
-        else if (this->is_set())
-            *this->assign_to_ = values_.back();
-    }
-}
+    public:
+        explicit FdStreamBuf(int fd) : fd_(fd)
+        {
+            setp(buffer_, buffer_ + sizeof(buffer_));
+        }
 
+    protected:
+        int_type overflow(int_type ch) override
+        {
+            if (sync() != 0)
+                return traits_type::eof();
+            if (ch == traits_type::eof())
+                return traits_type::not_eof(ch);
+            *pptr() = traits_type::to_char_type(ch);
+            pbump(1);
+            return ch;
+        }
 
-template <class T>
-inline void Value<T>::add_value(const T& value)
-{
-    values_.push_back(value);
-    update_reference();
-}
+        int sync() override
+        {
+            for (const char* pos = pbase(); pos < pptr();)
+            {
+                ssize_t ret = ::write(fd_, pos, static_cast<size_t>(pptr() - pos));
+                if ((ret < 0) && (errno == EINTR))
+                    continue;
+                if (ret <= 0)
+                    return -1;
+                pos += ret;
+            }
+            setp(buffer_, buffer_ + sizeof(buffer_));
+            return 0;
+        }
 
+    private:
+        int fd_;
+        char buffer_[4096];
+    };
 
-template <class T>
-inline void Value<T>::clear()
-{
-    values_.clear();
-    update_reference();
+    FdStreamBuf buffer(fd);
+    std::ostream out(&buffer);
+    write(out, non_default_only);
+    if (!out)
+        throw std::runtime_error(std::string("failed to write ini file: ") + strerror(errno));
 }
+#endif
 
 
 
-/// Implicit implementation /////////////////////////////////
+/// OptionOverlay implementation /////////////////////////////////
 
-template <class T>
-inline Implicit<T>::Implicit(const std::string& short_name, const std::string& long_name, const std::string& description, const T& implicit_val, T* assign_to)
-    : Value<T>(short_name, long_name, description, implicit_val, assign_to)
+inline OptionOverlay::OptionOverlay(const OptionParser* option_parser) : option_parser_(option_parser)
 {
 }
 
 
-template <class T>
-inline Argument Implicit<T>::argument_type() const
+inline Option_ptr OptionOverlay::override_option(const Option_ptr& option)
 {
-    return Argument::optional;
+    auto iter = overrides_.find(option->long_name_);
+    if (iter != overrides_.end())
+        return iter->second;
+    Option_ptr result = option->clone();
+    if (!result)
+        throw std::invalid_argument("option cannot be overridden, it does not implement clone(): " + option->long_name_);
+    result->clear();
+    overrides_[option->long_name_] = result;
+    return result;
 }
 
 
-template <class T>
-inline void Implicit<T>::parse(OptionName what_name, const char* value)
+inline void OptionOverlay::set(const std::string& long_name, const std::string& value)
 {
-    if ((value != nullptr) && (strlen(value) > 0))
-        Value<T>::parse(what_name, value);
-    else
-        this->add_value(*this->default_);
+    Option_ptr option = option_parser_->find_option(long_name);
+    if (!option)
+        throw std::invalid_argument("option not found: " + long_name);
+    option = override_option(option);
+    option->clear();
+    option->parse(OptionName::long_name, value.c_str());
 }
 
 
+inline void OptionOverlay::parse(const std::string& ini_filename)
+{
+    std::vector<OptionParser::IniLine> lines;
+    std::vector<std::string> unknown_options;
+    option_parser_->parse_ini(ini_filename, lines, unknown_options);
 
-/// Switch implementation /////////////////////////////////
+    /// Options that are set in the ini file replace their overrides
+    std::set<const Option*> cleared;
+    for (const auto& line : lines)
+    {
+        Option_ptr option = override_option(line.option);
+        if (cleared.insert(option.get()).second)
+            option->clear();
+        option->parse(OptionName::long_name, line.value.c_str());
+    }
+}
 
-inline Switch::Switch(const std::string& short_name, const std::string& long_name, const std::string& description, bool* assign_to)
-    : Value<bool>(short_name, long_name, description, false, assign_to)
+
+inline void OptionOverlay::reset(const std::string& long_name)
 {
+    overrides_.erase(long_name);
 }
 
 
-inline void Switch::parse(OptionName /*what_name*/, const char* /*value*/)
+inline size_t OptionOverlay::size() const
 {
-    add_value(true);
+    return overrides_.size();
 }
 
 
-inline Argument Switch::argument_type() const
+template <typename T>
+inline std::shared_ptr<T> OptionOverlay::get_option(const std::string& long_name) const
 {
-    return Argument::no;
+    auto iter = overrides_.find(long_name);
+    if (iter == overrides_.end())
+        return option_parser_->get_option<T>(long_name);
+    auto result = std::dynamic_pointer_cast<T>(iter->second);
+    if (!result)
+        throw std::invalid_argument("cannot cast option to T: " + long_name);
+    return result;
 }
 
 
 
-/// OptionParser implementation /////////////////////////////////
+/// OptionLayers implementation /////////////////////////////////
 
-inline OptionParser::OptionParser(std::string description) : description_(std::move(description))
+inline OptionLayers::OptionLayers(OptionParser* option_parser) : option_parser_(option_parser)
 {
 }
 
 
-template <typename T, typename... Ts>
-inline std::shared_ptr<T> OptionParser::add(Ts&&... params)
+inline void OptionLayers::add(int priority, const Option_ptr& option, const std::string& source, const std::string& value)
 {
-    return add<T, Attribute::optional>(std::forward<Ts>(params)...);
+    if (resolved_.count(option->long_name_) != 0)
+        throw std::logic_error("option already resolved: " + option->long_name_);
+    Layer& layer = layers_[option->long_name_][priority];
+    if (layer.values.empty())
+        layer.source = source;
+    layer.values.push_back(value);
 }
 
 
-template <typename T, Attribute attribute, typename... Ts>
-inline std::shared_ptr<T> OptionParser::add(Ts&&... params)
+inline void OptionLayers::set(int priority, const std::string& long_name, const std::string& value)
 {
-    static_assert(std::is_base_of<Option, typename std::decay<T>::type>::value, "type T must be Switch, Value or Implicit");
-    std::shared_ptr<T> option = std::make_shared<T>(std::forward<Ts>(params)...);
-
-    for (const auto& o : options_)
-    {
-        if ((option->short_name() != 0) && (option->short_name() == o->short_name()))
-            throw std::invalid_argument("duplicate short option name '-" + std::string(1, option->short_name()) + "'");
-        if (!option->long_name().empty() && (option->long_name() == (o->long_name())))
-            throw std::invalid_argument("duplicate long option name '--" + option->long_name() + "'");
-    }
-    option->set_attribute(attribute);
-    options_.push_back(option);
-    return option;
+    Option_ptr option = option_parser_->find_option(long_name);
+    if (!option)
+        throw std::invalid_argument("option not found: " + long_name);
+    add(priority, option, "set", value);
 }
 
 
-inline std::string OptionParser::description() const
+inline void OptionLayers::parse(int priority, const std::string& ini_filename)
 {
-    return description_;
+    std::vector<OptionParser::IniLine> lines;
+    option_parser_->parse_ini(ini_filename, lines, option_parser_->unknown_options_);
+    for (const auto& line : lines)
+        add(priority, line.option, ini_filename, line.value);
 }
 
 
-inline const std::vector<Option_ptr>& OptionParser::options() const
+inline void OptionLayers::parse_env(int priority, const std::string& prefix)
 {
-    return options_;
+    option_parser_->for_each_env(prefix, [this, priority](const Option_ptr& option, const std::string& variable, const char* value) {
+        if (!option)
+            option_parser_->unknown_options_.push_back(variable);
+        else
+            add(priority, option, variable, value);
+    });
 }
 
 
-inline const std::vector<std::string>& OptionParser::non_option_args() const
+inline const std::string& OptionLayers::resolve(const Option_ptr& option)
 {
-    return non_option_args_;
-}
-
+    auto iter = resolved_.find(option->long_name_);
+    if (iter != resolved_.end())
+        return iter->second;
 
-inline const std::vector<std::string>& OptionParser::unknown_options() const
-{
-    return unknown_options_;
+    std::string& source = resolved_[option->long_name_];
+    if (option->is_set())
+    {
+        /// Values that are set before the layers are resolved win, report where they come from
+        auto recorded = option_parser_->sources_.find(option.get());
+        source = (recorded != option_parser_->sources_.end()) ? recorded->second : "other";
+    }
+    else
+    {
+        auto layers = layers_.find(option->long_name_);
+        if (layers != layers_.end())
+        {
+            const Layer& layer = layers->second.begin()->second;
+            for (const auto& value : layer.values)
+                option->parse(OptionName::long_name, value.c_str());
+            source = layer.source;
+            layers_.erase(layers);
+        }
+    }
+    return source;
 }
 
 
-inline Option_ptr OptionParser::find_option(const std::string& long_name) const
+inline void OptionLayers::resolve()
 {
-    for (const auto& option : options_)
-        if (option->long_name() == long_name)
-            return option;
-    return nullptr;
+    for (const auto& option : option_parser_->options_)
+        if (!option->long_name_.empty())
+            resolve(option);
 }
 
 
-inline Option_ptr OptionParser::find_option(char short_name) const
+template <typename T>
+inline std::shared_ptr<T> OptionLayers::get_option(const std::string& long_name)
 {
-    for (const auto& option : options_)
-        if (option->short_name() == short_name)
-            return option;
-    return nullptr;
+    auto result = option_parser_->get_option<T>(long_name);
+    resolve(result);
+    return result;
 }
 
 
-template <typename T>
-inline std::shared_ptr<T> OptionParser::get_option(const std::string& long_name) const
+inline std::string OptionLayers::source(const std::string& long_name)
 {
-    Option_ptr option = find_option(long_name);
+    Option_ptr option = option_parser_->find_option(long_name);
     if (!option)
         throw std::invalid_argument("option not found: " + long_name);
-    auto result = std::dynamic_pointer_cast<T>(option);
-    if (!result)
-        throw std::invalid_argument("cannot cast option to T: " + long_name);
-    return result;
+    return resolve(option);
 }
 
 
-template <typename T>
-inline std::shared_ptr<T> OptionParser::get_option(char short_name) const
+
+/// IncrementalParser implementation /////////////////////////////////
+
+inline IncrementalParser::IncrementalParser(OptionParser& option_parser) : option_parser_(option_parser)
 {
-    Option_ptr option = find_option(short_name);
-    if (!option)
-        throw std::invalid_argument("option not found: " + std::string(1, short_name));
-    auto result = std::dynamic_pointer_cast<T>(option);
-    if (!result)
-        throw std::invalid_argument("cannot cast option to T: " + std::string(1, short_name));
-    return result;
 }
 
-inline void OptionParser::parse(const std::string& ini_filename)
+
+inline void IncrementalParser::feed(const std::string& arg)
 {
-    std::ifstream file(ini_filename.c_str());
-    std::string line;
+    OptionParser::ArgApplier applier{option_parser_};
+    option_parser_.split_arg(arg.c_str(), state_, applier);
+}
 
-    auto trim = [](std::string& s) {
-        s.erase(s.begin(), std::find_if(s.begin(), s.end(), [](int ch) { return !std::isspace(ch); }));
-        s.erase(std::find_if(s.rbegin(), s.rend(), [](int ch) { return !std::isspace(ch); }).base(), s.end());
-        return s;
-    };
 
-    auto trim_copy = [trim](const std::string& s) {
-        std::string copy(s);
-        return trim(copy);
-    };
+inline bool IncrementalParser::pending() const
+{
+    return state_.pending != nullptr;
+}
 
-    auto split = [trim_copy](const std::string& s) -> std::pair<std::string, std::string> {
-        size_t pos = s.find('=');
-        if (pos == std::string::npos)
-            return {"", ""};
-        return {trim_copy(s.substr(0, pos)), trim_copy(s.substr(pos + 1, std::string::npos))};
-    };
 
-    std::string section;
-    while (std::getline(file, line))
-    {
-        trim(line);
-        if (line.empty())
-            continue;
-        if (line.front() == '#')
-            continue;
+inline void IncrementalParser::finish()
+{
+    OptionParser::ArgApplier applier{option_parser_};
+    option_parser_.finish_args(state_, applier);
+    option_parser_.check_required();
+}
 
-        if ((line.front() == '[') && (line.back() == ']'))
-        {
-            section = trim_copy(line.substr(1, line.size() - 2));
-            continue;
-        }
-        auto key_value = split(line);
-        if (key_value.first.empty())
-            continue;
 
-        std::string key = section.empty() ? key_value.first : section + "." + key_value.first;
-        Option_ptr option = find_option(key);
-        if (option && (option->attribute() == Attribute::inactive))
-            option = nullptr;
 
-        if (option)
-            option->parse(OptionName::long_name, key_value.second.c_str());
-        else
-            unknown_options_.push_back(key);
-    }
-}
+/// ParseEvent implementation /////////////////////////////////
 
-inline void OptionParser::parse(int argc, const char* const argv[])
+inline ParseEvent::ParseEvent(Type type, Option_ptr option, OptionName what_name, std::string arg)
+    : type_(type), option_(std::move(option)), what_name_(what_name), arg_(std::move(arg))
 {
-    for (int n = 1; n < argc; ++n)
-    {
-        const std::string arg(argv[n]);
-        if (arg == "--")
-        {
-            /// from here on only non opt args
-            for (int m = n + 1; m < argc; ++m)
-                non_option_args_.emplace_back(argv[m]);
-        }
-        else if (arg.find("--") == 0)
-        {
-            /// long option arg
-            std::string opt = arg.substr(2);
-            std::string optarg;
-            size_t equalIdx = opt.find('=');
-            if (equalIdx != std::string::npos)
-            {
-                optarg = opt.substr(equalIdx + 1);
-                opt.resize(equalIdx);
-            }
+}
 
-            Option_ptr option = find_option(opt);
-            if (option && (option->attribute() == Attribute::inactive))
-                option = nullptr;
-            if (option)
-            {
-                if (option->argument_type() == Argument::no)
-                {
-                    if (!optarg.empty())
-                        option = nullptr;
-                }
-                else if (option->argument_type() == Argument::required)
-                {
-                    if (optarg.empty() && n < argc - 1)
-                        optarg = argv[++n];
-                }
-            }
 
-            if (option)
-                option->parse(OptionName::long_name, optarg.c_str());
-            else
-                unknown_options_.push_back(arg);
-        }
-        else if (arg.find('-') == 0)
-        {
-            /// short option arg
-            std::string opt = arg.substr(1);
-            bool unknown = false;
-            for (size_t m = 0; m < opt.size(); ++m)
-            {
-                char c = opt[m];
-                std::string optarg;
+inline ParseEvent::Type ParseEvent::type() const
+{
+    return type_;
+}
 
-                Option_ptr option = find_option(c);
-                if (option && (option->attribute() == Attribute::inactive))
-                    option = nullptr;
-                if (option)
-                {
-                    if (option->argument_type() == Argument::required)
-                    {
-                        /// use the rest of the current argument as optarg
-                        optarg = opt.substr(m + 1);
-                        /// or the next arg
-                        if (optarg.empty() && n < argc - 1)
-                            optarg = argv[++n];
-                        m = opt.size();
-                    }
-                    else if (option->argument_type() == Argument::optional)
-                    {
-                        /// use the rest of the current argument as optarg
-                        optarg = opt.substr(m + 1);
-                        m = opt.size();
-                    }
-                }
 
-                if (option)
-                    option->parse(OptionName::short_name, optarg.c_str());
-                else
-                    unknown = true;
-            }
-            if (unknown)
-                unknown_options_.push_back(arg);
-        }
-        else
-        {
-            non_option_args_.push_back(arg);
-        }
-    }
+inline const Option_ptr& ParseEvent::option() const
+{
+    return option_;
+}
 
-    for (auto& opt : options_)
-    {
-        if ((opt->attribute() == Attribute::required) && !opt->is_set())
-        {
-            std::string option = opt->long_name().empty() ? std::string(1, opt->short_name()) : opt->long_name();
-            throw invalid_option(opt.get(), invalid_option::Error::missing_option, "option \"" + option + "\" is required");
-        }
-    }
+
+inline OptionName ParseEvent::what_name() const
+{
+    return what_name_;
 }
 
 
-inline void OptionParser::reset()
+inline const std::string& ParseEvent::arg() const
 {
-    unknown_options_.clear();
-    non_option_args_.clear();
-    for (auto& opt : options_)
-        opt->clear();
+    return arg_;
 }
 
 
-inline std::string OptionParser::help(const Attribute& max_attribute) const
+template <typename T>
+inline T ParseEvent::value() const
 {
-    ConsoleOptionPrinter option_printer(this);
-    return option_printer.print(max_attribute);
+    auto option = std::dynamic_pointer_cast<Value<T>>(option_);
+    if (!option_)
+        throw std::invalid_argument("not an option: " + arg_);
+    if (!option)
+        throw std::invalid_argument("cannot cast option to T: " + option_->name(what_name_, true));
+    return option->convert(what_name_, arg_.c_str());
 }
 
 
 
-/// ConsoleOptionPrinter implementation /////////////////////////////////
+/// ParseEvents implementation /////////////////////////////////
 
-inline ConsoleOptionPrinter::ConsoleOptionPrinter(const OptionParser* option_parser) : OptionPrinter(option_parser)
+inline ParseEvents::ParseEvents(const OptionParser* option_parser, int argc, const char* const argv[])
+    : option_parser_(option_parser), argc_(argc), argv_(argv), arg_(1), finished_(false), event_(0)
 {
 }
 
 
-inline std::string ConsoleOptionPrinter::to_string(Option_ptr option) const
+inline bool ParseEvents::next()
 {
-    std::stringstream line;
-    if (option->short_name() != 0)
+    if (event_ + 1 < events_.size())
     {
-        line << "  -" << option->short_name();
-        if (!option->long_name().empty())
-            line << ", ";
+        ++event_;
+        return true;
     }
-    else
-        line << "  ";
-    if (!option->long_name().empty())
-        line << "--" << option->long_name();
 
-    if (option->argument_type() == Argument::required)
+    events_.clear();
+    event_ = 0;
+    Collector collector{events_};
+    while (events_.empty())
     {
-        line << " arg";
-        std::stringstream defaultStr;
-        if (option->get_default(defaultStr))
+        if (arg_ < argc_)
         {
-            if (!defaultStr.str().empty())
-                line << " (=" << defaultStr.str() << ")";
+            option_parser_->split_arg(argv_[arg_++], state_, collector);
         }
+        else if (!finished_)
+        {
+            finished_ = true;
+            option_parser_->finish_args(state_, collector);
+        }
+        else
+            return false;
     }
-    else if (option->argument_type() == Argument::optional)
-    {
-        std::stringstream defaultStr;
-        if (option->get_default(defaultStr))
-            line << " [=arg(=" << defaultStr.str() << ")]";
-    }
+    return true;
+}
 
-    return line.str();
+
+inline ParseEvents::iterator ParseEvents::begin()
+{
+    return iterator(next() ? this : nullptr);
 }
 
 
-inline std::string ConsoleOptionPrinter::print(const Attribute& max_attribute) const
+inline ParseEvents::iterator ParseEvents::end()
 {
-    if (option_parser_ == nullptr)
-        return "";
+    return iterator();
+}
 
-    if (max_attribute < Attribute::optional)
-        throw std::invalid_argument("attribute must be 'optional', 'advanced', or 'default'");
 
-    std::stringstream s;
-    if (!option_parser_->description().empty())
-        s << option_parser_->description() << ":\n";
+inline ParseEvents::iterator::iterator(ParseEvents* events) : events_(events)
+{
+}
 
-    size_t optionRightMargin(20);
-    const size_t maxDescriptionLeftMargin(40);
-    //	const size_t descriptionRightMargin(80);
 
-    for (const auto& option : option_parser_->options())
-        optionRightMargin = std::max(optionRightMargin, to_string(option).size() + 2);
-    optionRightMargin = std::min(maxDescriptionLeftMargin - 2, optionRightMargin);
+inline ParseEvents::iterator::reference ParseEvents::iterator::operator*() const
+{
+    return events_->events_[events_->event_];
+}
 
-    for (const auto& option : option_parser_->options())
-    {
-        if ((option->attribute() <= Attribute::hidden) || (option->attribute() > max_attribute))
-            continue;
-        std::string optionStr = to_string(option);
-        if (optionStr.size() < optionRightMargin)
-            optionStr.resize(optionRightMargin, ' ');
-        else
-            optionStr += "\n" + std::string(optionRightMargin, ' ');
-        s << optionStr;
 
-        std::string line;
-        std::vector<std::string> lines;
-        std::stringstream description(option->description());
-        while (std::getline(description, line, '\n'))
-            lines.push_back(line);
+inline ParseEvents::iterator::pointer ParseEvents::iterator::operator->() const
+{
+    return &events_->events_[events_->event_];
+}
 
-        std::string empty(optionRightMargin, ' ');
-        for (size_t n = 0; n < lines.size(); ++n)
-        {
-            if (n > 0)
-                s << "\n" << empty;
-            s << lines[n];
-        }
-        s << "\n";
-    }
 
-    return s.str();
+inline ParseEvents::iterator& ParseEvents::iterator::operator++()
+{
+    if (!events_->next())
+        events_ = nullptr;
+    return *this;
 }
 
 
+inline bool ParseEvents::iterator::operator==(const iterator& other) const
+{
+    return events_ == other.events_;
+}
 
-/// GroffOptionPrinter implementation /////////////////////////////////
 
-inline GroffOptionPrinter::GroffOptionPrinter(const OptionParser* option_parser) : OptionPrinter(option_parser)
+inline bool ParseEvents::iterator::operator!=(const iterator& other) const
 {
+    return events_ != other.events_;
 }
 
 
-inline std::string GroffOptionPrinter::to_string(Option_ptr option) const
+
+#ifdef __linux__
+/// IniFileWatcher implementation /////////////////////////////////
+
+inline IniFileWatcher::IniFileWatcher(OptionParser& option_parser, int debounce_ms)
+    : option_parser_(option_parser), debounce_ms_(debounce_ms), fd_(inotify_init1(IN_NONBLOCK | IN_CLOEXEC)), pending_(false)
 {
-    std::stringstream line;
-    if (option->short_name() != 0)
-    {
-        line << "-" << option->short_name();
-        if (!option->long_name().empty())
-            line << ", ";
-    }
-    if (!option->long_name().empty())
-        line << "--" << option->long_name();
+    if (fd_ < 0)
+        throw std::runtime_error(std::string("inotify_init1 failed: ") + strerror(errno));
 
-    if (option->argument_type() == Argument::required)
+    try
     {
-        line << " arg";
-        std::stringstream defaultStr;
-        if (option->get_default(defaultStr))
-        {
-            if (!defaultStr.str().empty())
-                line << " (=" << defaultStr.str() << ")";
-        }
+        add_watches();
     }
-    else if (option->argument_type() == Argument::optional)
+    catch (...)
     {
-        std::stringstream defaultStr;
-        if (option->get_default(defaultStr))
-            line << " [=arg(=" << defaultStr.str() << ")]";
+        close(fd_);
+        throw;
     }
-
-    return line.str();
+    content_changed();
 }
 
 
-inline std::string GroffOptionPrinter::print(const Attribute& max_attribute) const
+inline std::vector<std::string> IniFileWatcher::watched_files() const
 {
-    if (option_parser_ == nullptr)
-        return "";
-
-    if (max_attribute < Attribute::optional)
-        throw std::invalid_argument("attribute must be 'optional', 'advanced', or 'default'");
+    std::vector<std::string> files(option_parser_.ini_files());
+    files.insert(files.end(), option_parser_.included_files().begin(), option_parser_.included_files().end());
+    return files;
+}
 
-    std::stringstream s;
-    if (!option_parser_->description().empty())
-        s << ".SS " << option_parser_->description() << ":\n";
 
-    for (const auto& option : option_parser_->options())
+inline void IniFileWatcher::add_watches()
+{
+    /// Watch the directories to catch atomic replacements (write to temp file and rename)
+    const uint32_t mask = IN_CLOSE_WRITE | IN_MODIFY | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO;
+    for (const auto& ini_file : watched_files())
     {
-        if ((option->attribute() <= Attribute::hidden) || (option->attribute() > max_attribute))
+        if (!watched_.insert(ini_file).second)
             continue;
-        s << ".TP\n\\fB" << to_string(option) << "\\fR\n";
-        if (!option->description().empty())
-            s << option->description() << "\n";
+
+        /// key directories and included directories are watched themselves, all their files are relevant
+        struct stat st;
+        bool directory = option_parser_.is_key_dir(ini_file) || ((stat(ini_file.c_str(), &st) == 0) && ((st.st_mode & S_IFMT) == S_IFDIR));
+        size_t pos = directory ? ini_file.size() : ini_file.rfind('/');
+        std::string dir = (pos == std::string::npos) ? "." : ((pos == 0) ? "/" : ini_file.substr(0, pos));
+        int wd = inotify_add_watch(fd_, dir.c_str(), mask);
+        if (wd < 0)
+            throw std::runtime_error("failed to watch \"" + dir + "\": " + strerror(errno));
+        watches_.emplace_back(wd, (pos == std::string::npos) ? ini_file : ini_file.substr(std::min(pos + 1, ini_file.size())));
     }
+}
 
-    return s.str();
+
+inline IniFileWatcher::~IniFileWatcher()
+{
+    close(fd_);
 }
 
 
+inline int IniFileWatcher::fd() const
+{
+    return fd_;
+}
 
-/// BashCompletionOptionPrinter implementation /////////////////////////////////
 
-inline BashCompletionOptionPrinter::BashCompletionOptionPrinter(const OptionParser* option_parser, std::string program_name)
-    : OptionPrinter(option_parser), program_name_(std::move(program_name))
+inline bool IniFileWatcher::drain()
 {
+    alignas(struct inotify_event) char buffer[4096];
+    bool relevant = false;
+    ssize_t len;
+    while ((len = read(fd_, buffer, sizeof(buffer))) > 0)
+    {
+        for (char* ptr = buffer; ptr < buffer + len;)
+        {
+            const auto* event = reinterpret_cast<const struct inotify_event*>(ptr);
+            for (const auto& watch : watches_)
+                if ((event->wd == watch.first) && ((event->len == 0) || watch.second.empty() || (watch.second == event->name)))
+                    relevant = true;
+            ptr += sizeof(struct inotify_event) + event->len;
+        }
+    }
+    return relevant;
 }
 
 
-inline std::string BashCompletionOptionPrinter::print(const Attribute& /*max_attribute*/) const
+inline bool IniFileWatcher::content_changed()
 {
-    if (option_parser_ == nullptr)
-        return "";
+    std::map<std::string, uint64_t> hashes;
+    std::string content;
+    for (const auto& ini_file : watched_files())
+    {
+        struct stat st;
+        bool key_dir = option_parser_.is_key_dir(ini_file);
+        if (key_dir || ((stat(ini_file.c_str(), &st) == 0) && ((st.st_mode & S_IFMT) == S_IFDIR)))
+        {
+            /// hash of all file names, and for key directories their contents. A missing directory hashes to 0
+            uint64_t hash = 0;
+            try
+            {
+                hash = detail::fnv1a(nullptr, 0);
+                for (const auto& file : detail::list_key_files(ini_file))
+                {
+                    hash = detail::fnv1a(file.data(), file.size() + 1, hash);
+                    if (key_dir && detail::read_file(file, content))
+                        hash = detail::fnv1a(content.data(), content.size(), hash);
+                }
+            }
+            catch (const std::runtime_error&)
+            {
+                hash = 0;
+            }
+            hashes[ini_file] = hash;
+            continue;
+        }
+        /// missing files hash to 0, empty files to the FNV offset basis
+        hashes[ini_file] = detail::read_file(ini_file, content) ? detail::fnv1a(content.data(), content.size()) : 0;
+    }
+    if (hashes == hashes_)
+        return false;
+    hashes_.swap(hashes);
+    return true;
+}
 
-    std::stringstream s;
-    s << "_" << program_name_ << "()\n";
-    s << R"({
-	local cur prev opts
-	COMPREPLY=()
-	cur="${COMP_WORDS[COMP_CWORD]}"
-	prev="${COMP_WORDS[COMP_CWORD-1]}"
-	opts=")";
 
-    for (const auto& option : option_parser_->options())
+inline bool IniFileWatcher::process()
+{
+    auto now = std::chrono::steady_clock::now();
+    /// Coalesce bursts: defer the reload until the files are quiet for debounce_ms, but at most 10 times as long
+    if (drain())
     {
-        if (option->attribute() > Attribute::hidden)
+        if (!pending_)
         {
-            if (option->short_name() != 0)
-                s << "-" << option->short_name() << " ";
-            if (!option->long_name().empty())
-                s << "--" << option->long_name() << " ";
+            pending_ = true;
+            first_change_ = now;
         }
+        deadline_ = std::min(now + std::chrono::milliseconds(debounce_ms_), first_change_ + std::chrono::milliseconds(10 * debounce_ms_));
     }
+    if (!pending_ || (now < deadline_))
+        return false;
 
-    s << R"("
-	if [[ ${cur} == -* ]] ; then
-		COMPREPLY=( $(compgen -W "${opts}" -- ${cur}) )
-		return 0
-	fi
+    pending_ = false;
+    if (!content_changed())
+        return false;
+    option_parser_.reload();
+    /// the reloaded files may include other files
+    add_watches();
+    content_changed();
+    return true;
 }
-complete -F )";
-    s << "_" << program_name_ << " " << program_name_ << "\n";
 
-    return s.str();
+
+inline int IniFileWatcher::timeout() const
+{
+    if (!pending_)
+        return -1;
+    auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline_ - std::chrono::steady_clock::now()).count();
+    /// round up, so that the deadline has passed when poll returns
+    return static_cast<int>(std::max<decltype(remaining)>(0, remaining + 1));
+}
+
+
+inline bool IniFileWatcher::wait(int timeout_ms)
+{
+    auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    struct pollfd pfd = {fd_, POLLIN, 0};
+    while (true)
+    {
+        int poll_timeout = timeout();
+        if (timeout_ms >= 0)
+        {
+            auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(end - std::chrono::steady_clock::now()).count();
+            int left = static_cast<int>(std::max<decltype(remaining)>(0, remaining));
+            if ((poll_timeout < 0) || (left < poll_timeout))
+                poll_timeout = left;
+        }
+        int ret = poll(&pfd, 1, poll_timeout);
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+                return false;
+            throw std::runtime_error(std::string("poll failed: ") + strerror(errno));
+        }
+        bool was_pending = pending_;
+        if (process())
+            return true;
+        /// a change has been checked without reloading or only unrelated files have changed
+        if (!pending_ && (was_pending || (ret > 0)))
+            return false;
+        if ((timeout_ms >= 0) && (std::chrono::steady_clock::now() >= end))
+            return false;
+    }
 }
+#endif
 
 
 
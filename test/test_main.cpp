@@ -36,6 +36,22 @@ TEST_CASE("command line")
 }
 
 
+TEST_CASE("end of options")
+{
+    OptionParser op("Allowed options");
+    auto verbose_option = op.add<Switch>("v", "verbose", "test for switch");
+
+    /// arguments after "--" are added once as non option arguments and are not parsed as options
+    std::vector<const char*> args = {"popl", "--", "-v", "x"};
+    op.parse(static_cast<int>(args.size()), args.data());
+    REQUIRE(verbose_option->is_set() == false);
+    REQUIRE(op.non_option_args().size() == 2);
+    REQUIRE(op.non_option_args()[0] == "-v");
+    REQUIRE(op.non_option_args()[1] == "x");
+    REQUIRE(op.unknown_options().empty());
+}
+
+
 TEST_CASE("config file")
 {
     OptionParser op("Allowed options");
@@ -54,3 +70,1198 @@ TEST_CASE("config file")
     }
 }
 
+
+
+#ifdef __linux__
+TEST_CASE("ini file watcher")
+{
+    OptionParser op("Allowed options");
+    auto int_option = op.add<Value<int>>("i", "section.integer", "test for int value", 42);
+
+    std::ofstream("watch.conf") << "[section]\ninteger = 1\n";
+    op.parse("watch.conf");
+    REQUIRE(int_option->value() == 1);
+
+    IniFileWatcher watcher(op, 10);
+    /// atomic replace with identical content must not trigger a reload
+    std::ofstream("watch.conf.tmp") << "[section]\ninteger = 1\n";
+    std::rename("watch.conf.tmp", "watch.conf");
+    REQUIRE(watcher.wait(1000) == false);
+
+    std::ofstream("watch.conf.tmp") << "[section]\ninteger = 2\n";
+    std::rename("watch.conf.tmp", "watch.conf");
+    REQUIRE(watcher.wait(1000) == true);
+    REQUIRE(int_option->count() == 1);
+    REQUIRE(int_option->value() == 2);
+
+    /// process() does not block, the reload is deferred until timeout() has elapsed
+    IniFileWatcher slow_watcher(op, 200);
+    REQUIRE(slow_watcher.timeout() == -1);
+    std::ofstream("watch.conf.tmp") << "[section]\ninteger = 3\n";
+    std::rename("watch.conf.tmp", "watch.conf");
+    auto start = std::chrono::steady_clock::now();
+    REQUIRE(slow_watcher.process() == false);
+    REQUIRE(std::chrono::steady_clock::now() - start < std::chrono::milliseconds(100));
+    REQUIRE(slow_watcher.timeout() > 0);
+    REQUIRE(slow_watcher.timeout() <= 201);
+    REQUIRE(int_option->value() == 2);
+    std::this_thread::sleep_for(std::chrono::milliseconds(slow_watcher.timeout()));
+    REQUIRE(slow_watcher.process() == true);
+    REQUIRE(slow_watcher.timeout() == -1);
+    REQUIRE(int_option->value() == 3);
+    std::remove("watch.conf");
+}
+#endif
+
+
+TEST_CASE("incremental reload")
+{
+    OptionParser op("Allowed options");
+    auto int_option = op.add<Value<int>>("i", "section.integer", "test for int value", 42);
+    auto string_option = op.add<Value<std::string>>("s", "section.string", "test for string value");
+    auto multi_option = op.add<Value<int>>("m", "section.multi", "test for multiple values");
+
+    std::ofstream("reload.conf") << "[section]\ninteger = 1\nstring = hello\nmulti = 1\nmulti = 2\n";
+    op.parse("reload.conf");
+    REQUIRE(int_option->value() == 1);
+    REQUIRE(multi_option->count() == 2);
+
+    /// unchanged lines are not applied again
+    int_option->set_value(5);
+    std::ofstream("reload.conf") << "[section]\ninteger = 1\nstring = world\nmulti = 3\nmulti = 1\nmulti = 2\n";
+    op.reload();
+    REQUIRE(int_option->value() == 5);
+    REQUIRE(string_option->value() == "world");
+    REQUIRE(multi_option->count() == 3);
+    REQUIRE(multi_option->value(0) == 3);
+
+    /// removed lines clear the Option
+    std::ofstream("reload.conf") << "[section]\ninteger = 1\n";
+    op.reload();
+    REQUIRE(int_option->value() == 5);
+    REQUIRE(string_option->is_set() == false);
+    REQUIRE(multi_option->is_set() == false);
+
+    /// values of other sources are kept
+    std::ofstream("reload.conf") << "[section]\ninteger = 1\nmulti = 1\n";
+    op.reset();
+    op.parse("reload.conf");
+    std::vector<const char*> args = {"popl", "-i", "99", "-m", "7"};
+    op.parse(static_cast<int>(args.size()), args.data());
+    std::ofstream("reload.conf") << "[section]\ninteger = 22\nmulti = 2\nmulti = 3\n";
+    op.reload();
+    REQUIRE(int_option->count() == 2);
+    REQUIRE(int_option->value(0) == 22);
+    REQUIRE(int_option->value(1) == 99);
+    REQUIRE(multi_option->count() == 3);
+    REQUIRE(multi_option->value(0) == 2);
+    REQUIRE(multi_option->value(1) == 3);
+    REQUIRE(multi_option->value(2) == 7);
+
+    /// an invalid value leaves all Options untouched
+    std::ofstream("reload.conf") << "[section]\ninteger = 5\nmulti = abc\n";
+    REQUIRE_THROWS_AS(op.reload(), invalid_option);
+    REQUIRE(int_option->count() == 2);
+    REQUIRE(int_option->value(0) == 22);
+    REQUIRE(multi_option->count() == 3);
+    std::ofstream("reload.conf") << "[section]\ninteger = 5\n";
+    op.reload();
+    REQUIRE(int_option->count() == 2);
+    REQUIRE(int_option->value(0) == 5);
+    REQUIRE(int_option->value(1) == 99);
+    REQUIRE(multi_option->count() == 1);
+    REQUIRE(multi_option->value() == 7);
+    std::remove("reload.conf");
+}
+
+
+TEST_CASE("config file cache")
+{
+    std::remove("test.conf.cache");
+    for (size_t n = 0; n < 2; ++n)
+    {
+        OptionParser op("Allowed options");
+        auto int_option = op.add<Value<int>>("i", "section.integer", "test for int value", 42);
+        op.parse("test.conf", "test.conf.cache");
+        REQUIRE(std::ifstream("test.conf.cache").good());
+        REQUIRE(int_option->count() == 1);
+        REQUIRE(int_option->value() == 23);
+    }
+
+    /// a different set of options invalidates the cache
+    OptionParser op("Allowed options");
+    auto int_option = op.add<Value<int>>("i", "section.integer", "test for int value", 42);
+    auto other_option = op.add<Value<int>>("o", "section.other", "test for other value", 1);
+    op.parse("test.conf", "test.conf.cache");
+    REQUIRE(int_option->value() == 23);
+    REQUIRE(other_option->is_set() == false);
+    std::remove("test.conf.cache");
+}
+
+
+TEST_CASE("snapshot")
+{
+    OptionParser op("Allowed options");
+    op.add<Value<int>>("i", "section.integer", "test for int value", 42);
+    op.parse("test.conf");
+    std::string snapshot = op.snapshot();
+
+    OptionParser worker("Allowed options");
+    auto int_option = worker.add<Value<int>>("i", "section.integer", "test for int value", 42);
+    worker.parse_snapshot(snapshot.data(), snapshot.size());
+    REQUIRE(int_option->count() == 1);
+    REQUIRE(int_option->value() == 23);
+    REQUIRE(worker.ini_files().size() == 1);
+
+    OptionParser other("Allowed options");
+    other.add<Value<int>>("o", "section.other", "test for other value", 42);
+    REQUIRE_THROWS_AS(other.parse_snapshot(snapshot.data(), snapshot.size()), std::invalid_argument);
+
+#ifdef MFD_ALLOW_SEALING
+    int fd = op.snapshot_fd();
+    OptionParser fd_worker("Allowed options");
+    auto fd_int_option = fd_worker.add<Value<int>>("i", "section.integer", "test for int value", 42);
+    fd_worker.parse_snapshot(fd);
+    close(fd);
+    REQUIRE(fd_int_option->value() == 23);
+#endif
+}
+
+
+TEST_CASE("shared ini cache")
+{
+    std::ofstream("shared.conf") << "[section]\ninteger = 1\n";
+    OptionParser op1("Allowed options");
+    auto int_option1 = op1.add<Value<int>>("i", "section.integer", "test for int value", 42);
+    OptionParser op2("Allowed options");
+    auto int_option2 = op2.add<Value<int>>("", "section.integer", "test for int value", 42);
+    auto string_option2 = op2.add<Value<std::string>>("", "section.string", "test for string value");
+
+    op1.parse("shared.conf");
+    op2.parse("shared.conf");
+    REQUIRE(int_option1->value() == 1);
+    REQUIRE(int_option2->value() == 1);
+
+    /// modified files are tokenized again
+    std::ofstream("shared.conf") << "[section]\ninteger = 2\nstring = modified\n";
+    op2.reset();
+    op2.parse("shared.conf");
+    REQUIRE(int_option2->value() == 2);
+    REQUIRE(string_option2->value() == "modified");
+    OptionParser::clear_ini_cache();
+    std::remove("shared.conf");
+}
+
+
+TEST_CASE("indexed config file")
+{
+    std::ofstream("indexed.conf") << "# indexed\n[other]\ninteger = 5\n[section]\ninteger = 23\nstring = hello world\n[section]\ninteger = 24\n";
+    OptionParser::build_ini_index("indexed.conf", "indexed.conf.idx");
+
+    OptionParser op("Allowed options");
+    auto int_option = op.add<Value<int>>("i", "section.integer", "test for int value", 42);
+    auto string_option = op.add<Value<std::string>>("s", "section.string", "test for string value");
+    auto missing_option = op.add<Value<int>>("m", "section.missing", "test for missing value", 1);
+    op.parse_indexed("indexed.conf", "indexed.conf.idx");
+    REQUIRE(int_option->count() == 2);
+    REQUIRE(int_option->value(0) == 23);
+    REQUIRE(int_option->value(1) == 24);
+    REQUIRE(string_option->value() == "hello world");
+    REQUIRE(missing_option->is_set() == false);
+    REQUIRE(op.unknown_options().empty());
+
+    /// outdated index falls back to a full parse
+    std::ofstream("indexed.conf") << "[section]\ninteger = 7\n";
+    op.reset();
+    op.parse_indexed("indexed.conf", "indexed.conf.idx");
+    REQUIRE(int_option->count() == 1);
+    REQUIRE(int_option->value() == 7);
+
+    /// the keys of included files are not indexed: fall back to a full parse
+    std::ofstream("indexed.conf") << "include = indexed.inc\n[section]\ninteger = 8\n";
+    std::ofstream("indexed.inc") << "[section]\nstring = included\n";
+    OptionParser::build_ini_index("indexed.conf", "indexed.conf.idx");
+    op.reset();
+    op.set_includes(true);
+    op.parse_indexed("indexed.conf", "indexed.conf.idx");
+    REQUIRE(int_option->value() == 8);
+    REQUIRE(string_option->value() == "included");
+    std::remove("indexed.conf");
+    std::remove("indexed.conf.idx");
+    std::remove("indexed.inc");
+}
+
+
+TEST_CASE("config file keys")
+{
+    std::ofstream("keys.conf") << "global = 1\n[a.b]\nc = 2\n[a]\nb.c = 3\nbc = 4\n[ab]\nc = 5\n";
+    OptionParser op("Allowed options");
+    auto global_option = op.add<Value<int>>("", "global", "key without section");
+    auto abc_option = op.add<Value<int>>("", "a.b.c", "nested key");
+    op.parse("keys.conf");
+    REQUIRE(global_option->value() == 1);
+    REQUIRE(abc_option->count() == 2);
+    REQUIRE(abc_option->value(0) == 2);
+    REQUIRE(abc_option->value(1) == 3);
+    REQUIRE(op.unknown_options().size() == 1);
+    REQUIRE(op.unknown_options()[0] == "a.bc");
+
+    op.reset();
+    op.set_report_unknown_sections(true);
+    op.parse("keys.conf");
+    REQUIRE(op.unknown_options().size() == 2);
+    REQUIRE(op.unknown_options()[0] == "a.bc");
+    REQUIRE(op.unknown_options()[1] == "ab.c");
+    std::remove("keys.conf");
+}
+
+
+TEST_CASE("unknown sections")
+{
+    std::ofstream("sections.conf") << "[other]\ninteger = 5\nstring = other\n[section]\ninteger = 23\nunknown = 1\n[profile.prod.other]\ninteger = 6\n";
+    OptionParser op("Allowed options");
+    auto int_option = op.add<Value<int>>("i", "section.integer", "test for int value", 42);
+
+    /// sections without added Options are skipped
+    op.parse("sections.conf");
+    REQUIRE(int_option->value() == 23);
+    REQUIRE(op.unknown_options().size() == 1);
+    REQUIRE(op.unknown_options()[0] == "section.unknown");
+
+    op.reset();
+    op.set_report_unknown_sections(true);
+    op.parse("sections.conf");
+    REQUIRE(int_option->value() == 23);
+    REQUIRE(op.unknown_options().size() == 4);
+    REQUIRE(op.unknown_options()[0] == "other.integer");
+    REQUIRE(op.unknown_options()[1] == "other.string");
+    REQUIRE(op.unknown_options()[2] == "section.unknown");
+    REQUIRE(op.unknown_options()[3] == "profile.prod.other.integer");
+    std::remove("sections.conf");
+}
+
+
+#ifndef _WIN32
+TEST_CASE("config directory")
+{
+    std::system("mkdir -p conf.d");
+    std::ofstream("conf.d/10-base.conf") << "[section]\ninteger = 1\nstring = base\n";
+    std::ofstream("conf.d/20-override.conf") << "[section]\ninteger = 2\n";
+    std::ofstream("conf.d/30-ignored.txt") << "[section]\ninteger = 3\n";
+
+    OptionParser op("Allowed options");
+    auto int_option = op.add<Value<int>>("i", "section.integer", "test for int value", 42);
+    auto string_option = op.add<Value<std::string>>("s", "section.string", "test for string value");
+    op.parse_dir("conf.d");
+    REQUIRE(op.ini_files().size() == 2);
+    REQUIRE(int_option->count() == 2);
+    REQUIRE(int_option->value(0) == 1);
+    REQUIRE(int_option->value(1) == 2);
+    REQUIRE(string_option->value() == "base");
+    std::system("rm -rf conf.d");
+}
+#endif
+
+
+#ifndef _WIN32
+TEST_CASE("config file includes")
+{
+    std::system("mkdir -p include.d");
+    std::ofstream("include.conf") << "include = include.d/common.inc\ninclude_dir = include.d\n[section]\ninteger = 3\n";
+    std::ofstream("include.d/common.inc") << "[section]\ninteger = 1\n";
+    std::ofstream("include.d/10-a.conf") << "include = common.inc\n[section]\nstring = a\n";
+    std::ofstream("include.d/20-b.conf") << "include = common.inc\n[section]\ninteger = 2\n";
+
+    OptionParser op("Allowed options");
+    auto int_option = op.add<Value<int>>("i", "section.integer", "test for int value", 42);
+    auto string_option = op.add<Value<std::string>>("s", "section.string", "test for string value");
+
+    /// includes are disabled by default
+    op.parse("include.conf");
+    REQUIRE(int_option->count() == 1);
+    REQUIRE(op.unknown_options().size() == 2);
+    REQUIRE(op.unknown_options()[0] == "include");
+    REQUIRE(op.unknown_options()[1] == "include_dir");
+
+    op.reset();
+    op.set_includes(true);
+    op.parse("include.conf");
+    REQUIRE(int_option->count() == 3);
+    REQUIRE(int_option->value(0) == 1);
+    REQUIRE(int_option->value(1) == 2);
+    REQUIRE(int_option->value(2) == 3);
+    REQUIRE(string_option->value() == "a");
+    REQUIRE(op.unknown_options().empty());
+
+    /// includes of a stream are applied in place, relative to the working directory
+    std::istringstream stream("[section]\ninteger = 0\ninclude = include.conf\n[section]\ninteger = 4\n");
+    op.reset();
+    op.parse(stream);
+    REQUIRE(int_option->count() == 2);
+    REQUIRE(int_option->value(0) == 0);
+    REQUIRE(int_option->value(1) == 4);
+    std::istringstream top_level("integer = 0\ninclude = include.conf\n[section]\ninteger = 4\n");
+    op.reset();
+    op.parse(top_level);
+    REQUIRE(int_option->count() == 4);
+    REQUIRE(int_option->value(0) == 1);
+    REQUIRE(int_option->value(2) == 3);
+    REQUIRE(int_option->value(3) == 4);
+    REQUIRE(op.unknown_options().size() == 1);
+    REQUIRE(op.unknown_options()[0] == "integer");
+
+    std::ofstream("include.d/common.inc") << "include = ../include.conf\n";
+    op.reset();
+    REQUIRE_THROWS_AS(op.parse("include.conf"), std::runtime_error);
+    std::system("rm -rf include.d include.conf");
+}
+#endif
+
+
+TEST_CASE("config file interpolation")
+{
+    std::ofstream("interpolation.conf") << "[paths]\nroot = /srv/${env:POPL_TEST_APP}\n[section]\ndata = ${paths.root}/data\nlog = ${section.later}\n"
+                                           "threads = ${nproc}\ncycle = ${section.cycle}\nlater = ${paths.root}/log\n";
+#ifdef _WIN32
+    _putenv_s("POPL_TEST_APP", "app");
+#else
+    setenv("POPL_TEST_APP", "app", 1);
+#endif
+
+    OptionParser op("Allowed options");
+    auto data_option = op.add<Value<std::string>>("", "section.data", "test for interpolated value");
+    auto log_option = op.add<Value<std::string>>("", "section.log", "test for interpolated value");
+    auto threads_option = op.add<Value<int>>("", "section.threads", "test for builtin value");
+    op.set_interpolation(true);
+    op.parse("interpolation.conf");
+    REQUIRE(data_option->value() == "/srv/app/data");
+    REQUIRE(log_option->value() == "/srv/app/log");
+    REQUIRE(threads_option->value() >= 1);
+
+    /// disabled by default
+    OptionParser plain("Allowed options");
+    auto plain_option = plain.add<Value<std::string>>("", "section.data", "test for interpolated value");
+    plain.parse("interpolation.conf");
+    REQUIRE(plain_option->value() == "${paths.root}/data");
+
+    /// the index falls back to parsing the whole file for references
+    OptionParser indexed("Allowed options");
+    auto indexed_option = indexed.add<Value<std::string>>("", "section.data", "test for interpolated value");
+    indexed.set_interpolation(true);
+    OptionParser::build_ini_index("interpolation.conf", "interpolation.idx");
+    indexed.parse_indexed("interpolation.conf", "interpolation.idx");
+    REQUIRE(indexed_option->value() == "/srv/app/data");
+    std::remove("interpolation.idx");
+
+    auto cycle_option = op.add<Value<std::string>>("", "section.cycle", "test for cyclic reference");
+    REQUIRE_THROWS_AS(op.parse("interpolation.conf"), invalid_option);
+    std::remove("interpolation.conf");
+
+    const char escaped[] = "[section]\ndata = echo $${HOME} $$ ${nproc}\n";
+    OptionParser escape("Allowed options");
+    auto escaped_option = escape.add<Value<std::string>>("", "section.data", "test for escaped reference");
+    escape.set_interpolation(true);
+    escape.parse(escaped, sizeof(escaped) - 1);
+    REQUIRE(escaped_option->value() == "echo ${HOME} $$ " + std::to_string(std::max(1u, std::thread::hardware_concurrency())));
+
+    /// the cache depends on the interpolation setting, values expanded from the environment are not cached
+    std::ofstream("interpolation.conf") << "[paths]\nroot = /srv\n[section]\ndata = ${paths.root}/data\napp = ${env:POPL_TEST_APP}\n";
+    std::remove("interpolation.cache");
+    for (bool interpolation : {false, true})
+    {
+        OptionParser cached("Allowed options");
+        auto cached_option = cached.add<Value<std::string>>("", "section.data", "test for interpolated value");
+        cached.set_interpolation(interpolation);
+        cached.parse("interpolation.conf", "interpolation.cache");
+        REQUIRE(cached_option->value() == (interpolation ? "/srv/data" : "${paths.root}/data"));
+    }
+    for (const char* app : {"app", "other"})
+    {
+#ifdef _WIN32
+        _putenv_s("POPL_TEST_APP", app);
+#else
+        setenv("POPL_TEST_APP", app, 1);
+#endif
+        OptionParser cached("Allowed options");
+        auto app_option = cached.add<Value<std::string>>("", "section.app", "test for environment value");
+        cached.set_interpolation(true);
+        cached.parse("interpolation.conf", "interpolation.cache");
+        REQUIRE(app_option->value() == app);
+    }
+    std::remove("interpolation.cache");
+
+    /// references resolve to the keys of the selected profile
+    std::ofstream("interpolation.conf") << "[paths]\nroot = /srv\n[profile.prod.paths]\nroot = /prod\n[section]\ndata = ${paths.root}/data\n";
+    OptionParser profiled("Allowed options");
+    profiled.add<Value<std::string>>("", "profile", "profile", "prod");
+    auto profiled_option = profiled.add<Value<std::string>>("", "section.data", "test for interpolated value");
+    profiled.set_profile_option("profile");
+    profiled.set_interpolation(true);
+    profiled.parse("interpolation.conf");
+    REQUIRE(profiled_option->value() == "/prod/data");
+    std::remove("interpolation.conf");
+}
+
+
+TEST_CASE("config file profiles")
+{
+    std::ofstream("profile.conf") << "profile = staging\n[section]\ninteger = 1\nstring = base\n[profile.prod.section]\ninteger = 3\n"
+                                     "[profile.staging.section]\ninteger = 2\nmulti = 1\nmulti = 2\n";
+
+    OptionParser op("Allowed options");
+    auto profile_option = op.add<Value<std::string>>("p", "profile", "profile");
+    auto int_option = op.add<Value<int>>("i", "section.integer", "test for int value", 42);
+    auto string_option = op.add<Value<std::string>>("s", "section.string", "test for string value");
+    auto multi_option = op.add<Value<int>>("m", "section.multi", "test for multiple values");
+    op.set_profile_option("profile");
+    op.parse("profile.conf");
+    REQUIRE(int_option->count() == 1);
+    REQUIRE(int_option->value() == 2);
+    REQUIRE(string_option->value() == "base");
+    REQUIRE(multi_option->count() == 2);
+    REQUIRE(op.unknown_options().empty());
+
+    /// switch the profile on reload
+    std::ofstream("profile.conf") << "profile = prod\n[section]\ninteger = 1\nstring = base\n[profile.prod.section]\ninteger = 3\n"
+                                     "[profile.staging.section]\ninteger = 2\nmulti = 1\nmulti = 2\n";
+    op.reload();
+    REQUIRE(profile_option->value() == "prod");
+    REQUIRE(int_option->value() == 3);
+    REQUIRE(multi_option->is_set() == false);
+
+    /// the command line wins over the ini file
+    OptionParser cmd_op("Allowed options");
+    auto cmd_profile_option = cmd_op.add<Value<std::string>>("p", "profile", "profile");
+    auto cmd_int_option = cmd_op.add<Value<int>>("i", "section.integer", "test for int value", 42);
+    cmd_op.set_profile_option("profile");
+    std::ofstream("profile.conf") << "profile = staging\n[section]\ninteger = 1\n[profile.prod.section]\ninteger = 3\n[profile.staging.section]\ninteger = 2\n";
+    std::vector<const char*> args = {"popl", "--profile", "prod"};
+    cmd_op.parse(static_cast<int>(args.size()), args.data());
+    cmd_op.parse("profile.conf");
+    REQUIRE(cmd_profile_option->value() == "prod");
+    REQUIRE(cmd_int_option->count() == 1);
+    REQUIRE(cmd_int_option->value() == 3);
+
+    /// snapshots contain the effective values and do not depend on the profile
+    std::ofstream("profile.conf") << "profile = staging\n[section]\ninteger = 1\n[profile.staging.section]\ninteger = 2\n";
+    OptionParser parent("Allowed options");
+    parent.add<Value<std::string>>("p", "profile", "profile");
+    parent.add<Value<int>>("i", "section.integer", "test for int value", 42);
+    parent.set_profile_option("profile");
+    parent.parse("profile.conf");
+    std::string snapshot = parent.snapshot();
+    OptionParser worker("Allowed options");
+    worker.add<Value<std::string>>("p", "profile", "profile");
+    auto worker_int_option = worker.add<Value<int>>("i", "section.integer", "test for int value", 42);
+    worker.set_profile_option("profile");
+    worker.parse_snapshot(snapshot.data(), snapshot.size());
+    REQUIRE(worker_int_option->value() == 2);
+
+    /// indexed parsing applies the overlays
+    OptionParser::build_ini_index("profile.conf", "profile.conf.idx");
+    OptionParser indexed("Allowed options");
+    indexed.add<Value<std::string>>("p", "profile", "profile");
+    auto indexed_int_option = indexed.add<Value<int>>("i", "section.integer", "test for int value", 42);
+    indexed.set_profile_option("profile");
+    indexed.parse_indexed("profile.conf", "profile.conf.idx");
+    REQUIRE(indexed_int_option->value() == 2);
+
+    /// removing the profile key deselects the profile with the first reload
+    std::ofstream("profile.conf") << "[section]\ninteger = 1\n[profile.staging.section]\ninteger = 2\n";
+    parent.reload();
+    REQUIRE(parent.get_option<Value<std::string>>("profile")->is_set() == false);
+    REQUIRE(parent.get_option<Value<int>>("section.integer")->value() == 1);
+    std::remove("profile.conf");
+    std::remove("profile.conf.idx");
+}
+
+
+/// Option that implements only the pure virtual functions
+class Flag : public Option
+{
+public:
+    using Option::Option;
+
+    bool get_default(std::ostream& /*out*/) const override
+    {
+        return false;
+    }
+
+    Argument argument_type() const override
+    {
+        return Argument::no;
+    }
+
+    size_t count() const override
+    {
+        return count_;
+    }
+
+    bool is_set() const override
+    {
+        return count_ > 0;
+    }
+
+protected:
+    void parse(OptionName /*what_name*/, const char* /*value*/) override
+    {
+        ++count_;
+    }
+
+    void clear() override
+    {
+        count_ = 0;
+    }
+
+    size_t count_ = 0;
+};
+
+
+/// Option derived from Value without clone
+class Port : public Value<int>
+{
+public:
+    using Value<int>::Value;
+};
+
+
+/// Option derived from Value with clone
+class Level : public Value<int>
+{
+public:
+    using Value<int>::Value;
+
+    std::shared_ptr<Option> clone() const override
+    {
+        auto option = std::make_shared<Level>(short_name_, long_name_, description_);
+        option->values_ = values_;
+        return option;
+    }
+};
+
+
+TEST_CASE("option overlay")
+{
+    int assigned = 0;
+    OptionParser op("Allowed options");
+    auto int_option = op.add<Value<int>>("i", "section.integer", "test for int value", 42, &assigned);
+    auto implicit_option = op.add<Implicit<int>>("m", "implicit", "test for implicit value", 7);
+    op.add<Switch>("v", "verbose", "test for switch");
+    op.parse("test.conf");
+
+    OptionOverlay tenant(&op);
+    REQUIRE(tenant.get_option<Value<int>>("section.integer") == int_option);
+    tenant.set("section.integer", "5");
+    tenant.set("verbose", "");
+    REQUIRE(tenant.size() == 2);
+    REQUIRE(tenant.get_option<Value<int>>("section.integer")->value() == 5);
+    REQUIRE(tenant.get_option<Switch>("verbose")->is_set());
+    REQUIRE(tenant.get_option<Implicit<int>>("implicit") == implicit_option);
+
+    /// the base is not modified
+    REQUIRE(int_option->value() == 23);
+    REQUIRE(assigned == 23);
+    REQUIRE(op.get_option<Switch>("verbose")->is_set() == false);
+
+    tenant.reset("section.integer");
+    REQUIRE(tenant.get_option<Value<int>>("section.integer")->value() == 23);
+    tenant.parse("test.conf");
+    REQUIRE(tenant.get_option<Value<int>>("section.integer")->count() == 1);
+    REQUIRE_THROWS_AS(tenant.set("unknown", "1"), std::invalid_argument);
+
+    /// derived Options are not sliced: they are overridden only if they implement clone
+    op.add<Port>("", "port", "derived option without clone");
+    op.add<Level>("", "level", "derived option with clone");
+    REQUIRE_THROWS_AS(tenant.set("port", "80"), std::invalid_argument);
+    tenant.set("level", "3");
+    REQUIRE(tenant.get_option<Level>("level")->value() == 3);
+}
+
+
+TEST_CASE("config from memory")
+{
+    OptionParser op("Allowed options");
+    auto int_option = op.add<Value<int>>("i", "section.integer", "test for int value", 42);
+    auto string_option = op.add<Value<std::string>>("s", "section.string", "test for string value");
+
+    const char config[] = "[section]\ninteger = 23\nunknown = 1";
+    op.parse(config, sizeof(config) - 1);
+    REQUIRE(int_option->value() == 23);
+    REQUIRE(op.unknown_options().size() == 1);
+    REQUIRE(op.ini_files().empty());
+
+    std::istringstream stream("[section]\nstring = from stream\n");
+    op.parse(stream);
+    REQUIRE(string_option->value() == "from stream");
+
+    /// streamed lines are applied as they are read, with interpolation the whole stream is tokenized first
+    for (bool interpolation : {false, true})
+    {
+        std::string data;
+        for (int n = 0; n < 1000; ++n)
+            data += "[section]\ninteger = " + std::to_string(n) + "\n[other]\nkey = 1\n[section]\nunknown" + std::to_string(n) + " = 1\n";
+        std::istringstream many(data);
+        op.reset();
+        op.set_interpolation(interpolation);
+        op.parse(many);
+        REQUIRE(int_option->count() == 1000);
+        REQUIRE(int_option->value(999) == 999);
+        REQUIRE(op.unknown_options().size() == 1000);
+        REQUIRE(op.unknown_options()[999] == "section.unknown999");
+    }
+}
+
+
+TEST_CASE("ini writer")
+{
+    OptionParser op("Allowed options");
+    op.add<Switch>("v", "verbose", "test for switch");
+    op.add<Value<std::string>>("n", "name", "test for global value", "popl");
+    auto int_option = op.add<Value<int>>("i", "section.integer", "test for int value", 42);
+    op.add<Value<int>>("m", "section.multi", "test for multiple values");
+    op.add<Value<bool>>("b", "other.flag", "test for bool value", false);
+    std::vector<const char*> args = {"popl", "-v", "-m", "1", "-m", "2", "-b", "true"};
+    op.parse(static_cast<int>(args.size()), args.data());
+
+    std::stringstream all;
+    IniWriter(&op).write(all);
+    REQUIRE(all.str() == "verbose = true\nname = popl\n\n[section]\ninteger = 42\nmulti = 1\nmulti = 2\n\n[other]\nflag = true\n");
+
+    std::stringstream non_default;
+    int_option->set_value(42);
+    IniWriter(&op).write(non_default, true);
+    REQUIRE(non_default.str() == "verbose = true\n\n[section]\nmulti = 1\nmulti = 2\n\n[other]\nflag = true\n");
+
+    /// round trip
+    OptionParser reader("Allowed options");
+    auto multi_option = reader.add<Value<int>>("m", "section.multi", "test for multiple values");
+    auto verbose_option = reader.add<Switch>("v", "verbose", "test for switch");
+    std::string ini = all.str();
+    reader.parse(ini.data(), ini.size());
+    REQUIRE(verbose_option->is_set());
+    REQUIRE(multi_option->count() == 2);
+    REQUIRE(multi_option->value(1) == 2);
+}
+
+
+TEST_CASE("ini writer round trip")
+{
+    OptionParser op("Allowed options");
+    op.add<Value<double>>("d", "double", "test for double value", 0.1);
+    op.add<Value<float>>("f", "float", "test for float value");
+    op.add<Implicit<int>>("m", "verbosity", "test for implicit value", 3);
+    std::vector<const char*> args = {"popl", "-d", "3.14159265358979", "-f", "0.3"};
+    op.parse(static_cast<int>(args.size()), args.data());
+
+    std::stringstream ini;
+    IniWriter(&op).write(ini);
+    REQUIRE(ini.str() == "double = 3.14159265358979\nfloat = 0.3\n");
+
+    OptionParser reader("Allowed options");
+    auto double_option = reader.add<Value<double>>("d", "double", "test for double value", 0.1);
+    auto float_option = reader.add<Value<float>>("f", "float", "test for float value");
+    auto implicit_option = reader.add<Implicit<int>>("m", "verbosity", "test for implicit value", 3);
+    std::string content = ini.str();
+    reader.parse(content.data(), content.size());
+    REQUIRE(double_option->value() == 3.14159265358979);
+    REQUIRE(float_option->value() == 0.3f);
+    REQUIRE(!implicit_option->is_set());
+
+    std::vector<const char*> precise = {"popl", "-d", "0.30000000000000004"};
+    reader.parse(static_cast<int>(precise.size()), precise.data());
+    std::stringstream value;
+    double_option->get_value(value, 1);
+    REQUIRE(value.str() == "0.30000000000000004");
+    std::stringstream default_value;
+    double_option->get_default(default_value);
+    REQUIRE(default_value.str() == "0.1");
+
+    /// empty strings are skipped, "key =" would be a missing argument
+    OptionParser strings("Allowed options");
+    strings.add<Value<std::string>>("e", "s.empty_default", "test for empty default", "");
+    auto empty_option = strings.add<Value<std::string>>("v", "s.empty_value", "test for empty value");
+    auto name_option = strings.add<Value<std::string>>("n", "s.name", "test for string value");
+    empty_option->set_value("");
+    name_option->set_value("popl");
+    std::stringstream strings_ini;
+    IniWriter(&strings).write(strings_ini);
+    REQUIRE(strings_ini.str() == "[s]\nname = popl\n");
+    content = strings_ini.str();
+    strings.reset();
+    strings.parse(content.data(), content.size());
+    REQUIRE(name_option->value() == "popl");
+    REQUIRE(!empty_option->is_set());
+
+    /// Options that do not implement get_value are skipped
+    OptionParser custom("Allowed options");
+    custom.add<Flag>("", "flag", "test for custom option");
+    std::vector<const char*> flag_args = {"popl", "--flag"};
+    custom.parse(static_cast<int>(flag_args.size()), flag_args.data());
+    std::stringstream custom_ini;
+    IniWriter(&custom).write(custom_ini);
+    REQUIRE(custom_ini.str().empty());
+}
+
+
+TEST_CASE("json config")
+{
+    OptionParser op("Allowed options");
+    auto int_option = op.add<Value<int>>("i", "section.integer", "test for int value", 42);
+    auto string_option = op.add<Value<std::string>>("s", "section.string", "test for string value");
+    auto multi_option = op.add<Value<double>>("m", "section.multi", "test for multiple values");
+    auto verbose_option = op.add<Switch>("v", "verbose", "test for switch");
+    auto quiet_option = op.add<Switch>("q", "quiet", "test for switch");
+
+    std::string json = R"({"verbose": true, "quiet": false, "unknown": {"a": [1, {"b": null}]},
+        "section": {"integer": 23, "string": "h\u00e9llo \"w\"\n", "multi": [1.5, -2e3], "nested": {}}})";
+    op.parse_json(json.data(), json.size());
+    REQUIRE(int_option->value() == 23);
+    REQUIRE(string_option->value() == "h\xc3\xa9llo \"w\"\n");
+    REQUIRE(multi_option->count() == 2);
+    REQUIRE(multi_option->value(1) == -2000.);
+    REQUIRE(verbose_option->is_set());
+    REQUIRE(quiet_option->is_set() == false);
+    REQUIRE(op.unknown_options().size() == 1);
+    REQUIRE(op.unknown_options()[0] == "unknown.a");
+
+    std::string invalid = R"({"section": {"integer": 23)";
+    REQUIRE_THROWS_AS(op.parse_json(invalid.data(), invalid.size()), std::invalid_argument);
+
+    /// literals, numbers and escapes are validated
+    for (std::string value : {"tru", "nul", "True", "1..2", "01", "-", "1.", ".5", "1e", "+1", "0x10", "\"\\ud800\"", "\"\\udc00\"", "\"\\ud800\\u0041\"",
+                              "\"\\ud800x\"", "\"\\x\""})
+    {
+        std::string invalid_value = "{\"unknown\": " + value + "}";
+        INFO(invalid_value);
+        REQUIRE_THROWS_AS(op.parse_json(invalid_value.data(), invalid_value.size()), std::invalid_argument);
+    }
+    std::string valid = R"({"section": {"multi": [0, -0.5, 1E+2, 2e-1], "string": "\ud83d\ude00\/"}})";
+    op.parse_json(valid.data(), valid.size());
+    REQUIRE(multi_option->value(2) == 0.);
+    REQUIRE(multi_option->value(4) == 100.);
+    REQUIRE(string_option->value(1) == "\xf0\x9f\x98\x80/");
+}
+
+
+TEST_CASE("toml config")
+{
+    OptionParser op("Allowed options");
+    auto int_option = op.add<Value<int>>("i", "section.integer", "test for int value", 42);
+    auto string_option = op.add<Value<std::string>>("s", "section.string", "test for string value");
+    auto multi_option = op.add<Value<int>>("m", "section.multi", "test for multiple values");
+    auto date_option = op.add<Value<std::string>>("d", "section.sub.date", "test for date value");
+    auto verbose_option = op.add<Switch>("v", "verbose", "test for switch");
+    auto path_option = op.add<Value<std::string>>("p", "server.path", "test for literal string");
+
+    std::string toml = "verbose = true # comment\n"
+                       "server = { path = 'C:\\dir', port = 80 }\n"
+                       "[section]\n"
+                       "integer = 1_000\n"
+                       "string = \"\"\"\nmulti \\\n   line \\u00e9\"\"\"\n"
+                       "multi = [ 0x10, # hex\n 0b11, ]\n"
+                       "sub.date = 1979-05-27 07:32:00Z\n"
+                       "[[products]]\nname = \"hammer\"\n";
+    op.parse_toml(toml.data(), toml.size());
+    REQUIRE(verbose_option->is_set());
+    REQUIRE(path_option->value() == "C:\\dir");
+    REQUIRE(int_option->value() == 1000);
+    REQUIRE(string_option->value() == "multi line \xc3\xa9");
+    REQUIRE(multi_option->count() == 2);
+    REQUIRE(multi_option->value(0) == 16);
+    REQUIRE(multi_option->value(1) == 3);
+    REQUIRE(date_option->value() == "1979-05-27 07:32:00Z");
+    REQUIRE(op.unknown_options().size() == 2);
+    REQUIRE(op.unknown_options()[0] == "server.port");
+    REQUIRE(op.unknown_options()[1] == "products.name");
+
+    std::string invalid = "[section]\ninteger = \"unterminated\n";
+    REQUIRE_THROWS_AS(op.parse_toml(invalid.data(), invalid.size()), std::invalid_argument);
+
+    /// bare values must be booleans, numbers or date-times
+    for (const char* value : {"-1_000", "+0.5e-3", "6.626e34", "-inf", "nan", "0o17", "0xdead_BEEF", "1979-05-27", "1979-05-27T07:32:00.5-07:00",
+                              "07:32:00", "1979-05-27t07:32:00z"})
+    {
+        std::string valid = std::string("key = ") + value + "\n";
+        REQUIRE_NOTHROW(op.parse_toml(valid.data(), valid.size()));
+    }
+    for (const char* value : {"hello", "True", "1__0", "1_", "_1", "01", "1.", ".5", "1e", "1.2.3", "-0x10", "0xg", "0b12", "infinity",
+                              "1979-05-27T07:32", "1979-05-27 07:32:00+7", "12:30"})
+    {
+        std::string bare = std::string("key = ") + value + "\n";
+        REQUIRE_THROWS_AS(op.parse_toml(bare.data(), bare.size()), std::invalid_argument);
+    }
+}
+
+
+#ifndef _WIN32
+TEST_CASE("environment")
+{
+    OptionParser op("Allowed options");
+    auto int_option = op.add<Value<int>>("i", "section.integer", "test for int value", 42);
+    auto string_option = op.add<Value<std::string>>("s", "log-file", "test for string value");
+    auto verbose_option = op.add<Switch>("v", "verbose", "test for switch");
+    auto quiet_option = op.add<Switch>("q", "quiet", "test for switch");
+
+    setenv("POPLTEST_SECTION_INTEGER", "7", 1);
+    setenv("POPLTEST_LOG_FILE", "from env", 1);
+    setenv("POPLTEST_VERBOSE", "1", 1);
+    setenv("POPLTEST_QUIET", "false", 1);
+    setenv("POPLTEST_OTHER", "1", 1);
+
+    std::vector<const char*> args = {"popl", "--log-file", "from cli"};
+    op.parse(static_cast<int>(args.size()), args.data());
+    op.parse_env("POPLTEST_");
+    REQUIRE(int_option->value() == 7);
+    REQUIRE(string_option->count() == 1);
+    REQUIRE(string_option->value() == "from cli");
+    REQUIRE(verbose_option->is_set());
+    REQUIRE(!quiet_option->is_set());
+    REQUIRE(op.unknown_options().size() == 1);
+    REQUIRE(op.unknown_options()[0] == "POPLTEST_OTHER");
+
+    /// ini files parsed after the environment append their values
+    op.parse("test.conf");
+    REQUIRE(int_option->count() == 2);
+    REQUIRE(int_option->value(0) == 7);
+    REQUIRE(int_option->value(1) == 23);
+
+    /// layers define the precedence between environment and ini files
+    OptionParser layered("Allowed options");
+    int assigned = 0;
+    auto layered_option = layered.add<Value<int>>("i", "section.integer", "test for int value", 42, &assigned);
+    OptionLayers layers(&layered);
+    layers.parse(1, "test.conf");
+    layers.parse_env(2, "POPLTEST_");
+    REQUIRE(layers.get_option<Value<int>>("section.integer")->count() == 1);
+    REQUIRE(layered_option->value() == 7);
+    REQUIRE(assigned == 7);
+
+    for (const char* name : {"POPLTEST_SECTION_INTEGER", "POPLTEST_LOG_FILE", "POPLTEST_VERBOSE", "POPLTEST_QUIET", "POPLTEST_OTHER"})
+        unsetenv(name);
+}
+#endif
+
+
+TEST_CASE("option layers")
+{
+    OptionParser op("Allowed options");
+    auto int_option = op.add<Value<int>>("i", "section.integer", "test for int value", 42);
+    auto float_option = op.add<Value<float>>("f", "float", "test for float value", 1.5f);
+    auto string_option = op.add<Value<std::string>>("s", "string", "test for string value");
+    auto verbose_option = op.add<Switch>("v", "verbose", "test for switch");
+
+    std::vector<const char*> args = {"popl", "--string", "cli"};
+    op.parse(static_cast<int>(args.size()), args.data());
+
+    OptionLayers layers(&op);
+    /// lower layers are never converted, so an invalid value does not throw
+    layers.set(0, "section.integer", "invalid");
+    layers.parse(1, "test.conf");
+    layers.set(2, "string", "overridden by cli");
+    layers.set(2, "verbose", "");
+    REQUIRE(!verbose_option->is_set());
+
+    REQUIRE(layers.get_option<Value<int>>("section.integer")->value() == 23);
+    REQUIRE(int_option->count() == 1);
+    REQUIRE(layers.source("section.integer") == "test.conf");
+    REQUIRE(layers.get_option<Value<std::string>>("string")->value() == "cli");
+    REQUIRE(layers.source("string") == "command line");
+    REQUIRE(layers.source("float").empty());
+    REQUIRE(float_option->value() == 1.5f);
+
+    layers.resolve();
+    REQUIRE(verbose_option->is_set());
+    REQUIRE(layers.source("verbose") == "set");
+    REQUIRE_THROWS_AS(layers.set(3, "verbose", ""), std::logic_error);
+    REQUIRE_THROWS_AS(layers.source("unknown"), std::invalid_argument);
+
+    /// values that are set before by other sources than the command line report their source
+    OptionParser preset("Allowed options");
+    preset.add<Value<int>>("i", "section.integer", "test for int value", 42);
+    preset.add<Value<std::string>>("s", "string", "test for string value");
+    preset.parse("test.conf");
+    std::istringstream stream("string = from stream\n");
+    preset.parse(stream);
+    OptionLayers preset_layers(&preset);
+    preset_layers.set(0, "section.integer", "1");
+    REQUIRE(preset_layers.get_option<Value<int>>("section.integer")->value() == 23);
+    REQUIRE(preset_layers.source("section.integer") == "test.conf");
+    REQUIRE(preset_layers.source("string") == "ini data");
+}
+
+
+#ifdef __linux__
+TEST_CASE("key directory")
+{
+    std::system("rm -rf keys.d && mkdir -p keys.d");
+    std::ofstream("keys.d/section.integer") << "23\n";
+    std::ofstream("keys.d/password") << "secret\r\n";
+    std::ofstream("keys.d/.hidden") << "1\n";
+    std::ofstream("keys.d/unknown") << "1\n";
+    std::string large(100000, 'x');
+    std::ofstream("keys.d/certificate") << large << "\n";
+
+    OptionParser op("Allowed options");
+    auto int_option = op.add<Value<int>>("i", "section.integer", "test for int value", 42);
+    auto password_option = op.add<Value<std::string>>("p", "password", "test for string value");
+    auto certificate_option = op.add<Value<std::string>>("c", "certificate", "test for large value");
+    op.parse_key_dir("keys.d");
+    REQUIRE(op.is_key_dir("keys.d"));
+    REQUIRE(int_option->value() == 23);
+    REQUIRE(password_option->value() == "secret");
+    REQUIRE(certificate_option->value() == large);
+    REQUIRE(op.unknown_options().size() == 1);
+    REQUIRE(op.unknown_options()[0] == "unknown");
+
+    IniFileWatcher watcher(op, 10);
+    std::ofstream("keys.d/section.integer.tmp") << "24\n";
+    std::rename("keys.d/section.integer.tmp", "keys.d/section.integer");
+    REQUIRE(watcher.wait(1000) == true);
+    REQUIRE(int_option->count() == 1);
+    REQUIRE(int_option->value() == 24);
+    REQUIRE(password_option->value() == "secret");
+    std::system("rm -rf keys.d");
+}
+#endif
+
+
+#ifndef _WIN32
+TEST_CASE("response files")
+{
+    std::system("mkdir -p rsp.d");
+    std::ofstream("rsp.d/args.rsp") << "# comment\n--string \"hello \\\"world\\\"\" -i\\\n 5 @rsp.d/nested.rsp 'single quoted' -- @rsp.d/nested.rsp\n";
+    std::ofstream("rsp.d/nested.rsp") << "-v\n\"\"";
+    std::ofstream("rsp.d/cycle.rsp") << "-v @rsp.d/../rsp.d/cycle.rsp";
+
+    OptionParser op("Allowed options");
+    auto int_option = op.add<Value<int>>("i", "int", "test for int value", 42);
+    auto string_option = op.add<Value<std::string>>("s", "string", "test for string value");
+    auto verbose_option = op.add<Switch>("v", "verbose", "test for switch");
+    op.set_response_files(true);
+
+    std::vector<const char*> args = {"popl", "@rsp.d/args.rsp", "positional"};
+    op.parse(static_cast<int>(args.size()), args.data());
+    REQUIRE(string_option->value() == "hello \"world\"");
+    REQUIRE(int_option->value() == 5);
+    REQUIRE(verbose_option->is_set());
+    REQUIRE(op.non_option_args().size() == 4);
+    REQUIRE(op.non_option_args()[0] == "");
+    REQUIRE(op.non_option_args()[1] == "single quoted");
+    REQUIRE(op.non_option_args()[2] == "@rsp.d/nested.rsp");
+    REQUIRE(op.non_option_args()[3] == "positional");
+
+    /// "--" as argument of an option does not end the expansion
+    OptionParser arg_op("Allowed options");
+    auto arg_string_option = arg_op.add<Value<std::string>>("s", "string", "test for string value");
+    auto arg_verbose_option = arg_op.add<Switch>("v", "verbose", "test for switch");
+    arg_op.set_response_files(true);
+    for (std::vector<const char*> string_args : {std::vector<const char*>{"popl", "--string", "--", "@rsp.d/nested.rsp"},
+                                                 std::vector<const char*>{"popl", "-s", "--", "@rsp.d/nested.rsp"}})
+    {
+        arg_op.reset();
+        arg_op.parse(static_cast<int>(string_args.size()), string_args.data());
+        REQUIRE(arg_string_option->value() == "--");
+        REQUIRE(arg_verbose_option->is_set());
+        REQUIRE(arg_op.non_option_args().size() == 1);
+        REQUIRE(arg_op.non_option_args()[0] == "");
+    }
+
+    /// the argument of an option is not expanded
+    for (std::vector<const char*> mention_args : {std::vector<const char*>{"popl", "--string", "@bob"}, std::vector<const char*>{"popl", "-s", "@bob"}})
+    {
+        arg_op.reset();
+        arg_op.parse(static_cast<int>(mention_args.size()), mention_args.data());
+        REQUIRE(arg_string_option->value() == "@bob");
+        REQUIRE(arg_op.non_option_args().empty());
+    }
+
+    args = {"popl", "@rsp.d/cycle.rsp"};
+    REQUIRE_THROWS_AS(op.parse(static_cast<int>(args.size()), args.data()), std::runtime_error);
+    args = {"popl", "@rsp.d/missing.rsp"};
+    REQUIRE_THROWS_AS(op.parse(static_cast<int>(args.size()), args.data()), std::runtime_error);
+    std::system("rm -rf rsp.d");
+}
+#endif
+
+
+TEST_CASE("command line string")
+{
+    OptionParser op("Allowed options");
+    auto int_option = op.add<Value<int>>("i", "int", "test for int value", 42);
+    auto string_option = op.add<Value<std::string>>("s", "string", "test for string value");
+    auto verbose_option = op.add<Switch>("v", "verbose", "test for switch");
+
+    op.parse_command_line("  -vi 5 --string='a b'\"\\$c\"\\ d pos\\ it\"ion\"al '' # comment");
+    REQUIRE(verbose_option->is_set());
+    REQUIRE(int_option->value() == 5);
+    REQUIRE(string_option->value() == "a b$c d");
+    REQUIRE(op.non_option_args().size() == 2);
+    REQUIRE(op.non_option_args()[0] == "pos itional");
+    REQUIRE(op.non_option_args()[1] == "");
+
+    REQUIRE_THROWS_AS(op.parse_command_line("--string 'unterminated"), std::invalid_argument);
+}
+
+
+#ifdef __linux__
+TEST_CASE("proc cmdline")
+{
+    OptionParser op("Allowed options");
+    auto verbose_option = op.add<Switch>("v", "verbose", "test for switch");
+    op.parse_proc_cmdline();
+    REQUIRE(!verbose_option->is_set());
+
+    std::ifstream cmdline("/proc/self/cmdline");
+    std::string arg;
+    std::vector<std::string> args;
+    while (std::getline(cmdline, arg, '\0'))
+        args.push_back(arg);
+    REQUIRE(op.non_option_args().size() + op.unknown_options().size() == args.size() - 1);
+}
+#endif
+
+
+TEST_CASE("incremental parser")
+{
+    OptionParser op("Allowed options");
+    auto int_option = op.add<Value<int>>("i", "int", "test for int value", 42);
+    auto string_option = op.add<Value<std::string>, Attribute::required>("s", "string", "test for string value");
+    auto verbose_option = op.add<Switch>("v", "verbose", "test for switch");
+
+    IncrementalParser parser(op);
+    parser.feed("-vi");
+    REQUIRE(verbose_option->is_set());
+    REQUIRE(parser.pending());
+    REQUIRE(!int_option->is_set());
+    parser.feed("5");
+    REQUIRE(!parser.pending());
+    REQUIRE(int_option->value() == 5);
+    parser.feed("--string");
+    parser.feed("--");
+    REQUIRE(string_option->value() == "--");
+    parser.feed("--");
+    parser.feed("-v");
+    REQUIRE(verbose_option->count() == 1);
+    REQUIRE(op.non_option_args().size() == 1);
+    parser.finish();
+
+    op.reset();
+    parser.feed("--int");
+    REQUIRE_THROWS_AS(parser.finish(), invalid_option);
+    REQUIRE(!parser.pending());
+    parser.feed("-i");
+    parser.feed("7");
+    REQUIRE_THROWS_AS(parser.finish(), invalid_option);
+}
+
+
+TEST_CASE("parse events")
+{
+    OptionParser op("Allowed options");
+    auto int_option = op.add<Value<int>>("i", "int", "test for int value", 42);
+    auto implicit_option = op.add<Implicit<int>>("m", "implicit", "test for implicit value", 7);
+    auto verbose_option = op.add<Switch>("v", "verbose", "test for switch");
+    auto string_option = op.add<Value<std::string>, Attribute::required>("s", "string", "test for string value");
+
+    std::vector<const char*> args = {"popl", "-vxi", "5", "--implicit", "file", "--", "-v", "--string"};
+    std::vector<ParseEvent> events;
+    for (const auto& event : op.events(static_cast<int>(args.size()), args.data()))
+        events.push_back(event);
+
+    REQUIRE(events.size() == 8);
+    REQUIRE(events[0].type() == ParseEvent::Type::option);
+    REQUIRE(events[0].option() == verbose_option);
+    REQUIRE(events[0].value<bool>() == true);
+    REQUIRE(events[1].type() == ParseEvent::Type::unknown);
+    REQUIRE(events[1].arg() == "-vxi");
+    REQUIRE(events[2].option() == int_option);
+    REQUIRE(events[2].what_name() == OptionName::short_name);
+    REQUIRE(events[2].value<int>() == 5);
+    REQUIRE(events[3].option() == implicit_option);
+    REQUIRE(events[3].value<int>() == 7);
+    REQUIRE(events[4].type() == ParseEvent::Type::non_option);
+    REQUIRE(events[4].arg() == "file");
+    REQUIRE(events[5].type() == ParseEvent::Type::end_of_options);
+    REQUIRE(events[6].type() == ParseEvent::Type::non_option);
+    REQUIRE(events[6].arg() == "-v");
+    REQUIRE(events[7].arg() == "--string");
+    REQUIRE_THROWS_AS(events[2].value<std::string>(), std::invalid_argument);
+    REQUIRE_THROWS_AS(events[4].value<int>(), std::invalid_argument);
+
+    /// the Options are not modified
+    REQUIRE(!verbose_option->is_set());
+    REQUIRE(!int_option->is_set());
+    REQUIRE(!string_option->is_set());
+    REQUIRE(op.non_option_args().empty());
+    REQUIRE(op.unknown_options().empty());
+
+    /// a missing argument is reported when it is converted
+    args = {"popl", "--string"};
+    auto range = op.events(static_cast<int>(args.size()), args.data());
+    auto iter = range.begin();
+    REQUIRE(iter != range.end());
+    REQUIRE(iter->option() == string_option);
+    REQUIRE_THROWS_AS(iter->value<std::string>(), invalid_option);
+    REQUIRE(++iter == range.end());
+}
+
+
+TEST_CASE("string conversion")
+{
+    OptionParser op("Allowed options");
+    auto implicit_option = op.add<Implicit<std::string>>("m", "str", "test for implicit string", "implicit");
+    auto string_option = op.add<Value<std::string>>("s", "string", "test for string value");
+
+    std::vector<const char*> args = {"popl", "--str", "--string", "hello world"};
+    op.parse(static_cast<int>(args.size()), args.data());
+    REQUIRE(implicit_option->value() == "implicit");
+    REQUIRE(string_option->value() == "hello world");
+
+    std::vector<ParseEvent> events;
+    for (const auto& event : op.events(static_cast<int>(args.size()), args.data()))
+        events.push_back(event);
+    REQUIRE(events.size() == 2);
+    REQUIRE(events[0].value<std::string>() == "implicit");
+    REQUIRE(events[1].value<std::string>() == "hello world");
+
+    args = {"popl", "--string="};
+    REQUIRE_THROWS_AS(op.parse(static_cast<int>(args.size()), args.data()), invalid_option);
+}
+
+
+#ifdef __linux__
+TEST_CASE("included files")
+{
+    std::ofstream("main.conf") << "include = inc.conf\n";
+    std::ofstream("inc.conf") << "[section]\ninteger = 1\n";
+    std::remove("main.cache");
+
+    OptionParser op("Allowed options");
+    auto int_option = op.add<Value<int>>("i", "section.integer", "test for int value", 42);
+    op.set_includes(true);
+    op.parse("main.conf", "main.cache");
+    REQUIRE(int_option->value() == 1);
+    REQUIRE(op.included_files().count("inc.conf") == 1);
+
+    /// the cache is invalidated by changes of included files
+    std::ofstream("inc.conf") << "[section]\ninteger = 222\n";
+    OptionParser cached("Allowed options");
+    auto cached_option = cached.add<Value<int>>("i", "section.integer", "test for int value", 42);
+    cached.set_includes(true);
+    cached.parse("main.conf", "main.cache");
+    REQUIRE(cached_option->value() == 222);
+    REQUIRE(cached.included_files().count("inc.conf") == 1);
+
+    /// included files are watched
+    IniFileWatcher watcher(cached, 10);
+    std::ofstream("inc.conf.tmp") << "[section]\ninteger = 3\n";
+    std::rename("inc.conf.tmp", "inc.conf");
+    REQUIRE(watcher.wait(1000) == true);
+    REQUIRE(cached_option->count() == 1);
+    REQUIRE(cached_option->value() == 3);
+
+    std::remove("main.conf");
+    std::remove("inc.conf");
+    std::remove("main.cache");
+}
+#endif